@@ -0,0 +1,368 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <new>
+#include <atomic>
+
+#include "ttl_cache.hpp"
+#include "dummy_cache.hpp"
+#include "realtime_ttl_cache.hpp"
+#include "ttl_cache_trace.hpp"
+
+/* performance benchmarks, in the style of google-benchmark but without dependencies.
+   each benchmark replays a pre-generated sequence of requests against a cache:
+   a request reads a key and, on a miss, inserts it (cache-aside), or, with some probability,
+   writes the key directly. the logical time advances by one unit per request.
+
+   reported per benchmark:
+   - throughput, in millions of requests per second (measured without per-request timers)
+   - latency percentiles (p50/p99/p999) of single requests, measured in a separate run
+   - hit ratio of the reads
+   - bytes per cached entry, from the heap memory allocated by the cache (via a counting operator new)
+
+   usage: ./benchmarks [filter]
+   only the benchmarks whose name contains 'filter' are run
+
+   with ./benchmarks --replay trace maxEntries [filter], the benchmarks instead replay a trace recorded
+   with ttl_cache_recorder (int keys and values, long long time stamps; see ttl_cache_trace.hpp) against
+   each cache configuration with 'maxEntries', and report the time per operation, the hit ratio,
+   the gets whose outcome differs from the recorded one, the hits whose value differs from the oracle
+   (dummy_cache, which never evicts, and whose hit ratio is the upper bound), and the bytes per entry.
+   the realtime caches are not replayed, since they take their time stamps from the clock
+*/
+
+
+/*** heap accounting ***/
+
+//atomic, since the clock and reaper threads of the realtime caches also allocate
+static std::atomic<std::size_t> liveHeapBytes{0};
+
+void* operator new(std::size_t size) {
+  //the size is stored in front of the allocation, to be able to subtract it on delete
+  void* block = std::malloc(size + sizeof(std::max_align_t));
+  if (!block) throw std::bad_alloc();
+  *static_cast<std::size_t*>(block) = size;
+  liveHeapBytes.fetch_add(size, std::memory_order_relaxed);
+  return static_cast<char*>(block) + sizeof(std::max_align_t);
+}
+
+void operator delete(void* ptr) noexcept {
+  if (!ptr) return;
+  void* block = static_cast<char*>(ptr) - sizeof(std::max_align_t);
+  liveHeapBytes.fetch_sub(*static_cast<std::size_t*>(block), std::memory_order_relaxed);
+  std::free(block);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept { operator delete(ptr); }
+
+
+/*** workloads ***/
+
+struct Request {
+  int key;
+  bool isWrite; //otherwise, a read, followed by an insert on a miss
+  long long ttl;
+};
+
+enum class KeyDistribution { uniform, zipfian, scanThenHot };
+enum class TTLDistribution { longLived, mixed };
+
+std::string name(KeyDistribution dist) {
+  switch (dist) {
+    case KeyDistribution::uniform: return "uniform";
+    case KeyDistribution::zipfian: return "zipf";
+    case KeyDistribution::scanThenHot: return "scan_hot";
+  }
+  return "";
+}
+
+std::string name(TTLDistribution dist) {
+  return dist == TTLDistribution::longLived ? "long_ttl" : "mixed_ttl";
+}
+
+/* maps the i-th key of the universe to a distinct, scattered int (multiplication by an odd constant
+   is a bijection modulo 2^32). with consecutive keys and the identity std::hash<int>, a table whose
+   capacity does not divide the size of the universe gets some positions more loaded than others,
+   which would measure the hash function rather than the cache */
+inline int scatter(uint32_t i) { return (int) (i * 2654435761u); }
+
+/* keys are drawn from a universe 4 times larger than the cache
+   - uniform: all keys equally likely
+   - zipfian: key of rank i has probability proportional to 1/i^0.99
+   - scanThenHot: reads of a hot set (a quarter of the cache size, zipfian) interrupted by long scans
+     of keys that are never seen again, which flush an LRU cache
+   ttl distributions, in requests:
+   - longLived: every entry lives 100 times longer than the whole run
+   - mixed: half the entries live 1000 requests, the other half between 1000 and 100*maxEntries
+*/
+std::vector<Request> generateRequests(KeyDistribution keyDist, TTLDistribution ttlDist,
+                                      std::size_t maxEntries, int numRequests, double writeRatio) {
+  std::mt19937_64 RNG{42};
+  std::uniform_real_distribution<double> unit(0, 1);
+
+  int numKeys = 4 * maxEntries;
+  int numHotKeys = std::max(1, (int) maxEntries / 4);
+
+  auto zipfCDF = [](int n) {
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (int i = 0; i < n; i++) cdf[i] = (sum += 1.0/std::pow(i+1, 0.99));
+    for (double& x : cdf) x /= sum;
+    return cdf;
+  };
+  std::vector<double> cdf;
+  if (keyDist == KeyDistribution::zipfian) cdf = zipfCDF(numKeys);
+  if (keyDist == KeyDistribution::scanThenHot) cdf = zipfCDF(numHotKeys);
+  auto sampleZipf = [&]() { return (int) (std::lower_bound(cdf.begin(), cdf.end(), unit(RNG)) - cdf.begin()); };
+
+  std::vector<Request> res(numRequests);
+  int nextScanKey = numKeys; //scanned keys are outside the universe, so they are never repeated
+  for (int i = 0; i < numRequests; i++) {
+    Request& req = res[i];
+    switch (keyDist) {
+      case KeyDistribution::uniform: req.key = scatter(RNG()%numKeys); break;
+      case KeyDistribution::zipfian: req.key = scatter(sampleZipf()); break;
+      case KeyDistribution::scanThenHot:
+        //scans of 2*maxEntries requests, every 8*maxEntries requests
+        if (i % (8*maxEntries) < 6*maxEntries) req.key = scatter(sampleZipf());
+        else req.key = scatter(nextScanKey++);
+        break;
+    }
+    req.isWrite = unit(RNG) < writeRatio;
+    if (ttlDist == TTLDistribution::longLived) req.ttl = 100LL * numRequests;
+    else req.ttl = RNG()%2 == 0 ? 1000 : 1000 + RNG()%(100*maxEntries);
+  }
+  return res;
+}
+
+
+/*** caches under test ***/
+
+/* uniform interface over the caches under test:
+   get(key, time), insert(key, value, time, ttl), maintenance(time), size() */
+template<class Cache>
+struct logical_time_adapter {
+  Cache cache;
+  template<class... Args> logical_time_adapter(Args&&... args): cache(std::forward<Args>(args)...) {}
+  bool get(int key, long long time) { return (bool) cache.get(key, time); }
+  void insert(int key, int value, long long time, long long ttl) { cache.insert(key, value, time, ttl); }
+  void maintenance(long long time) { cache.removeExpired(time, 0.25); }
+  std::size_t size() { return cache.size(); }
+};
+
+struct dummy_adapter {
+  dummy_cache<int,int> cache;
+  dummy_adapter(std::size_t, double) {}
+  bool get(int key, long long time) { return (bool) cache.get(key, time); }
+  void insert(int key, int value, long long time, long long ttl) { cache.insert(key, value, time, ttl); }
+  void maintenance(long long) {}
+  std::size_t size() { return cache.size(); }
+};
+
+/* the realtime cache ignores the logical time and uses the clock instead, in microseconds.
+   ttls are scaled assuming about 100ns per request */
+template<class Clock>
+struct realtime_adapter {
+  realtime_ttl_cache<int, int, std::hash<int>, 1000000, ttl_cache<int, int>, Clock> cache;
+  realtime_adapter(std::size_t maxEntries, double maxLoadFactor): cache(maxEntries, maxLoadFactor, std::hash<int>()) {}
+  bool get(int key, long long) { return (bool) cache.get(key); }
+  void insert(int key, int value, long long, long long ttl) { cache.insert(key, value, std::max(1LL, ttl/10)); }
+  void maintenance(long long) { cache.removeExpired(0.25); }
+  std::size_t size() { return cache.size(); }
+};
+
+struct inline_options : ttl_cache_options { static constexpr bool INLINE_STORAGE = true; };
+struct pow2_options : ttl_cache_options { static constexpr bool POW2_CAPACITY = true; };
+struct robin_hood_options : ttl_cache_options { static constexpr bool ROBIN_HOOD = true; };
+struct lazy_get_options : ttl_cache_options { static constexpr bool LAZY_GET = true; };
+struct clock_options : ttl_cache_options { static constexpr bool CLOCK_EVICTION = true; };
+struct tiny_lfu_options : ttl_cache_options { static constexpr bool TINY_LFU = true; };
+struct control_bytes_options : ttl_cache_options { static constexpr bool CONTROL_BYTES = true; };
+struct compact_options : ttl_cache_options { static constexpr bool COMPACT_ENTRIES = true; };
+
+template<class Options>
+struct ttl_adapter : logical_time_adapter<ttl_cache<int, int, std::hash<int>, long long, Options>> {
+  ttl_adapter(std::size_t maxEntries, double maxLoadFactor):
+    logical_time_adapter<ttl_cache<int, int, std::hash<int>, long long, Options>>(maxEntries, maxLoadFactor, std::hash<int>()) {}
+};
+
+
+/*** benchmark runner ***/
+
+template<class T> struct type_tag { typedef T type; };
+
+static constexpr int MAINTENANCE_PERIOD = 10000; //requests between calls to the expire algorithm
+
+template<class Adapter>
+bool processRequest(Adapter& cache, const Request& req, long long time) {
+  if (req.isWrite) {
+    cache.insert(req.key, req.key, time, req.ttl);
+    return false;
+  }
+  bool hit = cache.get(req.key, time);
+  if (!hit) cache.insert(req.key, req.key, time, req.ttl);
+  return hit;
+}
+
+template<class Adapter>
+void runBenchmark(const std::string& benchName, const std::vector<Request>& requests,
+                  std::size_t maxEntries, double maxLoadFactor) {
+
+  //throughput and memory
+  std::size_t heapBefore = liveHeapBytes.load(std::memory_order_relaxed);
+  auto* cache = new Adapter(maxEntries, maxLoadFactor);
+  int hits = 0, reads = 0;
+  auto startTime = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < requests.size(); i++) {
+    if (processRequest(*cache, requests[i], i+1)) hits++;
+    if (not requests[i].isWrite) reads++;
+    if (i % MAINTENANCE_PERIOD == 0) cache->maintenance(i+1);
+  }
+  auto endTime = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(endTime - startTime).count();
+  double bytesPerEntry = (liveHeapBytes.load(std::memory_order_relaxed) - heapBefore) / (double) std::max<std::size_t>(1, cache->size());
+  delete cache;
+
+  //latency, on a fresh cache
+  cache = new Adapter(maxEntries, maxLoadFactor);
+  std::vector<uint32_t> latencies(requests.size());
+  for (std::size_t i = 0; i < requests.size(); i++) {
+    auto before = std::chrono::steady_clock::now();
+    processRequest(*cache, requests[i], i+1);
+    auto after = std::chrono::steady_clock::now();
+    latencies[i] = (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count();
+    if (i % MAINTENANCE_PERIOD == 0) cache->maintenance(i+1);
+  }
+  delete cache;
+  auto percentile = [&latencies](double p) {
+    std::size_t k = std::min(latencies.size()-1, (std::size_t) (p * latencies.size()));
+    std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+    return latencies[k];
+  };
+
+  std::cout<<std::left<<std::setw(64)<<benchName<<std::right<<std::fixed
+           <<std::setw(9)<<std::setprecision(2)<<requests.size()/seconds/1e6
+           <<std::setw(8)<<percentile(0.5)<<std::setw(8)<<percentile(0.99)<<std::setw(9)<<percentile(0.999)
+           <<std::setw(9)<<std::setprecision(1)<<100.0*hits/std::max(1, reads)
+           <<std::setw(11)<<std::setprecision(1)<<bytesPerEntry<<std::endl;
+}
+
+/*** trace replay ***/
+
+typedef std::vector<ttl_cache_trace_record<int, int>> Trace;
+
+template<class Cache, class... CacheArgs>
+void runReplay(const std::string& benchName, const Trace& trace, const std::vector<std::optional<int>>& oracleResults,
+               CacheArgs&&... cacheArgs) {
+  std::size_t heapBefore = liveHeapBytes.load(std::memory_order_relaxed);
+  auto* cache = new Cache(std::forward<CacheArgs>(cacheArgs)...);
+  std::size_t wrongHits = 0;
+  ttl_cache_replay_result result = ttl_cache_replay(trace, *cache,
+    [&oracleResults, &wrongHits](std::size_t i, const std::optional<int>& value) {
+      if (value and value != oracleResults[i]) wrongHits++;
+    });
+  double bytesPerEntry = (liveHeapBytes.load(std::memory_order_relaxed) - heapBefore) / (double) std::max<std::size_t>(1, cache->size());
+  delete cache;
+
+  std::cout<<std::left<<std::setw(48)<<benchName<<std::right<<std::fixed
+           <<std::setw(9)<<std::setprecision(1)<<result.nanosPerOperation()
+           <<std::setw(9)<<std::setprecision(2)<<100.0*result.hitRatio()
+           <<std::setw(11)<<result.divergences<<std::setw(8)<<wrongHits
+           <<std::setw(11)<<std::setprecision(1)<<bytesPerEntry<<std::endl;
+}
+
+void replayBenchmarks(const std::string& path, std::size_t maxEntries, const std::string& filter) {
+  Trace trace = ttl_cache_read_trace<int, int>(path);
+  std::cout<<"replaying "<<trace.size()<<" operations from "<<path<<" with "<<maxEntries<<" entries"<<std::endl;
+  std::cout<<std::left<<std::setw(48)<<"benchmark"<<std::right<<std::setw(9)<<"ns/op"<<std::setw(9)<<"hit%"
+           <<std::setw(11)<<"diverged"<<std::setw(8)<<"wrong"<<std::setw(11)<<"B/entry"<<std::endl;
+
+  std::vector<std::optional<int>> oracleResults(trace.size());
+  {
+    dummy_cache<int, int> oracle;
+    ttl_cache_replay(trace, oracle, [&oracleResults](std::size_t i, const std::optional<int>& value) { oracleResults[i] = value; });
+  }
+  auto run = [&](auto cacheTag, const std::string& cacheName, double maxLoadFactor) {
+    std::string benchName = "BM_replay_" + cacheName + "/lf:" + std::to_string(maxLoadFactor).substr(0, 4);
+    if (benchName.find(filter) == std::string::npos) return;
+    runReplay<typename decltype(cacheTag)::type>(benchName, trace, oracleResults, maxEntries, maxLoadFactor, std::hash<int>());
+  };
+  auto ttlCache = [](auto optionsTag) {
+    return type_tag<ttl_cache<int, int, std::hash<int>, long long, typename decltype(optionsTag)::type>>();
+  };
+  for (double maxLoadFactor : {0.25, 0.5}) {
+    run(ttlCache(type_tag<ttl_cache_options>()), "ttl_cache", maxLoadFactor);
+    run(ttlCache(type_tag<inline_options>()), "ttl_cache_inline", maxLoadFactor);
+    run(ttlCache(type_tag<pow2_options>()), "ttl_cache_pow2", maxLoadFactor);
+    run(ttlCache(type_tag<lazy_get_options>()), "ttl_cache_lazy_get", maxLoadFactor);
+    run(ttlCache(type_tag<clock_options>()), "ttl_cache_clock", maxLoadFactor);
+    run(ttlCache(type_tag<tiny_lfu_options>()), "ttl_cache_tiny_lfu", maxLoadFactor);
+    run(ttlCache(type_tag<control_bytes_options>()), "ttl_cache_control_bytes", maxLoadFactor);
+    run(ttlCache(type_tag<compact_options>()), "ttl_cache_compact", maxLoadFactor);
+  }
+  for (double maxLoadFactor : {0.5, 0.8}) {
+    run(ttlCache(type_tag<robin_hood_options>()), "ttl_cache_robin_hood", maxLoadFactor);
+  }
+  if (std::string("BM_replay_dummy_cache").find(filter) != std::string::npos) {
+    runReplay<dummy_cache<int, int>>("BM_replay_dummy_cache", trace, oracleResults);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc > 3 and std::string(argv[1]) == "--replay") {
+    replayBenchmarks(argv[2], std::stoull(argv[3]), argc > 4 ? argv[4] : "");
+    return 0;
+  }
+  std::string filter = argc > 1 ? argv[1] : "";
+
+  int numRequests = 2000000;
+  double writeRatio = 0.1;
+
+  std::cout<<std::left<<std::setw(64)<<"benchmark"<<std::right<<std::setw(9)<<"Mreq/s"
+           <<std::setw(8)<<"p50ns"<<std::setw(8)<<"p99ns"<<std::setw(9)<<"p999ns"
+           <<std::setw(9)<<"hit%"<<std::setw(11)<<"B/entry"<<std::endl;
+
+  for (std::size_t maxEntries : {10000, 1000000}) {
+    for (KeyDistribution keyDist : {KeyDistribution::uniform, KeyDistribution::zipfian, KeyDistribution::scanThenHot}) {
+      for (TTLDistribution ttlDist : {TTLDistribution::longLived, TTLDistribution::mixed}) {
+
+        std::string suffix = "/" + name(keyDist) + "/" + name(ttlDist) + "/" + std::to_string(maxEntries);
+        std::vector<Request> requests;
+        auto run = [&](auto adapterTag, const std::string& cacheName, double maxLoadFactor) {
+          std::string benchName = "BM_" + cacheName + suffix + "/lf:" + std::to_string(maxLoadFactor).substr(0, 4);
+          if (benchName.find(filter) == std::string::npos) return;
+          if (requests.empty()) requests = generateRequests(keyDist, ttlDist, maxEntries, numRequests, writeRatio);
+          runBenchmark<typename decltype(adapterTag)::type>(benchName, requests, maxEntries, maxLoadFactor);
+        };
+
+        for (double maxLoadFactor : {0.25, 0.5}) {
+          run(type_tag<ttl_adapter<ttl_cache_options>>(), "ttl_cache", maxLoadFactor);
+          run(type_tag<ttl_adapter<inline_options>>(), "ttl_cache_inline", maxLoadFactor);
+          run(type_tag<ttl_adapter<pow2_options>>(), "ttl_cache_pow2", maxLoadFactor);
+          run(type_tag<ttl_adapter<lazy_get_options>>(), "ttl_cache_lazy_get", maxLoadFactor);
+          run(type_tag<ttl_adapter<clock_options>>(), "ttl_cache_clock", maxLoadFactor);
+          run(type_tag<ttl_adapter<tiny_lfu_options>>(), "ttl_cache_tiny_lfu", maxLoadFactor);
+          run(type_tag<ttl_adapter<control_bytes_options>>(), "ttl_cache_control_bytes", maxLoadFactor);
+          run(type_tag<ttl_adapter<compact_options>>(), "ttl_cache_compact", maxLoadFactor);
+          run(type_tag<realtime_adapter<realtime_steady_clock>>(), "realtime_ttl_cache", maxLoadFactor);
+          run(type_tag<realtime_adapter<realtime_coarse_clock<>>>(), "realtime_ttl_cache_coarse_clock", maxLoadFactor);
+          run(type_tag<realtime_adapter<realtime_tsc_clock>>(), "realtime_ttl_cache_tsc_clock", maxLoadFactor);
+        }
+        for (double maxLoadFactor : {0.5, 0.8}) {
+          run(type_tag<ttl_adapter<robin_hood_options>>(), "ttl_cache_robin_hood", maxLoadFactor);
+        }
+        run(type_tag<dummy_adapter>(), "dummy_cache", 1);
+      }
+    }
+  }
+}
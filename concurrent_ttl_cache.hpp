@@ -0,0 +1,156 @@
+#ifndef CONCURRENT_TTL_CACHE_H
+#define CONCURRENT_TTL_CACHE_H
+
+#include "ttl_cache.hpp"
+#include "single_flight.hpp" //get_or_load
+#include "ttl_cache_shards.hpp"
+#include <mutex> //one writer lock per shard
+#include <atomic> //seqlock version counters
+#include <cstdint>
+#include <algorithm> //max
+
+/* read-optimized thread-safe cache: like sharded_ttl_cache, the keys are partitioned into shards,
+   but readers never take locks. writers (insert, removeExpired) still serialize on a mutex per shard.
+
+   each shard is protected by a sequence lock ("seqlock"): a version counter that writers make odd
+   while they modify the shard, and even again when they are done. a reader takes the version,
+   looks up the key with ttl_cache::peek (which does not write to the table), copies the value, and
+   then checks that the version did not change. if it changed, a writer ran at the same time, so the
+   copy may be inconsistent and is discarded, and the read is retried. after a few failed attempts,
+   the reader takes the writer lock, so readers cannot be starved by writers.
+
+   for the copies of inconsistent entries to be harmless, the shards use inline storage (so the keys
+   and values must be trivially copyable): there are no KeyValue nodes that a writer could free or
+   reuse while a reader follows a pointer to them. the shards also use the CLOCK eviction policy,
+   so a read only sets a reference byte instead of moving the pair in the LRU list.
+
+   as in sharded_ttl_cache, time stamps are only required to be increasing per shard, and they are
+   clamped to the current time of the shard. readers do not advance the time of the shard
+*/
+template<class Key, class Value, class HashFunction = std::hash<Key>, class timestamp_t = long long int>
+class concurrent_ttl_cache {
+
+  struct shard_options : ttl_cache_options {
+    static constexpr bool INLINE_STORAGE = true;
+    static constexpr bool CLOCK_EVICTION = true;
+  };
+  typedef ttl_cache<Key,Value,HashFunction,timestamp_t,shard_options> shard_cache_t;
+
+  static constexpr unsigned int OPTIMISTIC_READ_ATTEMPTS = 4;
+
+  //aligned to (a typical) cache line so that neighbouring shards do not falsely share their versions
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> version; //odd while a writer modifies the cache
+    std::mutex lock; //taken by the writers, and by the readers that failed too many optimistic attempts
+    shard_cache_t cache;
+    Shard(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction):
+      version{0},
+      cache(maxEntries, maxLoadFactor, hashFunction) {}
+  };
+
+  //marks a shard as being written for its lifetime. the writer lock must be held
+  class WriteSection {
+    Shard& shard;
+  public:
+    WriteSection(Shard& shard): shard{shard} {
+      shard.version.store(shard.version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release); //the odd version is visible before any write
+    }
+    ~WriteSection() {
+      shard.version.store(shard.version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+  };
+
+  ttl_cache_shards<Shard,Key,HashFunction> shards;
+  single_flight_loader<Key,Value,HashFunction,timestamp_t> loads;
+
+public:
+
+  static constexpr std::size_t DEFAULT_SHARD_COUNT = 16;
+
+  //the number of shards must be a power of two
+  concurrent_ttl_cache(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction,
+                       std::size_t shardCount = DEFAULT_SHARD_COUNT):
+    shards(maxEntries, maxLoadFactor, hashFunction, shardCount),
+    loads(hashFunction) {}
+
+  //lock-free unless writers keep interrupting the read
+  std::optional<Value> get(const Key& key, timestamp_t timeStamp) const {
+    return read(shards.shardFor(key), [&key, timeStamp](const shard_cache_t& cache) { return cache.peek(key, timeStamp); });
+  }
+
+  void insert(const Key& key, const Value& value, timestamp_t timeStamp, timestamp_t ttl) {
+    Shard& shard = shards.shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    WriteSection section(shard);
+    shard.cache.insert(key, value, std::max(timeStamp, shard.cache.currentTimeStamp()), ttl);
+  }
+
+  /* like get, but a key that is not cached is loaded with 'loader' (called with the key) and inserted with
+     'ttl'. concurrent misses of the same key only call the loader once, and with 'refreshAhead', keys are
+     reloaded shortly before they expire (see single_flight.hpp). the lookups are lock-free, as in get
+  */
+  template<class Loader>
+  Value get_or_load(const Key& key, timestamp_t timeStamp, Loader&& loader, timestamp_t ttl,
+                    timestamp_t refreshAhead = 0) {
+    auto lookup = [this, timeStamp](const Key& key) {
+      return read(shards.shardFor(key), [&key, timeStamp](const shard_cache_t& cache) {
+        std::optional<std::pair<Value, timestamp_t>> res;
+        std::optional<Value> value = cache.peek(key, timeStamp);
+        std::optional<timestamp_t> remaining = cache.remaining_ttl(key, timeStamp);
+        if (value and remaining) res.emplace(*value, *remaining);
+        return res;
+      });
+    };
+    auto store = [this, timeStamp, ttl](const Key& key, const Value& value) { insert(key, value, timeStamp, ttl); };
+    return loads.getOrLoad(key, lookup, std::forward<Loader>(loader), store, refreshAhead);
+  }
+
+  /* runs the expire algorithm on each shard in turn, so only one shard is locked at a time.
+     'maxExamined' bounds the work in each shard. returns the average of the expired ratios of the shards
+  */
+  double removeExpired(timestamp_t timeStamp, double targetRatio,
+                       std::size_t maxExamined = std::numeric_limits<std::size_t>::max()) {
+    double expiredRatioSum = 0;
+    for (std::size_t i = 0; i < shards.count(); i++) {
+      Shard& shard = shards[i];
+      std::lock_guard<std::mutex> guard(shard.lock);
+      WriteSection section(shard);
+      expiredRatioSum += shard.cache.removeExpired(std::max(timeStamp, shard.cache.currentTimeStamp()),
+                                                   targetRatio, maxExamined);
+    }
+    return expiredRatioSum / shards.count();
+  }
+
+  //aggregated over all the shards. with concurrent writers, the result is only a snapshot
+  std::size_t size() const { return shards.size(); }
+  bool empty() const { return size() == 0; }
+  std::size_t capacity() const { return shards.capacity(); }
+  double loadFactor() const { return size()/(double) capacity(); }
+  std::size_t shardCount() const { return shards.count(); }
+
+private:
+
+  /* runs 'read' (which must only read the cache, e.g. with peek) on the cache of the shard, optimistically:
+     it is retried if a writer modified the shard at the same time, or run under the writer lock
+     after a few failed attempts
+  */
+  template<class Read>
+  auto read(Shard& shard, const Read& read) const {
+    for (unsigned int attempt = 0; attempt < OPTIMISTIC_READ_ATTEMPTS; attempt++) {
+      uint64_t version = shard.version.load(std::memory_order_acquire);
+      if (version % 2 == 1) continue; //a writer is in the middle of a modification
+      auto res = read(shard.cache);
+      std::atomic_thread_fence(std::memory_order_acquire); //the reads of peek happen before the check
+      if (shard.version.load(std::memory_order_relaxed) == version) return res;
+    }
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return read(shard.cache);
+  }
+
+};
+
+template<class Key, class Value, class HashFunction, class timestamp_t>
+struct is_thread_safe_cache<concurrent_ttl_cache<Key,Value,HashFunction,timestamp_t>> : std::true_type {};
+
+#endif /* CONCURRENT_TTL_CACHE_H */
@@ -46,6 +46,20 @@ public:
     return {};
   }
 
+  //removes all the expired pairs (exactly, unlike the sampling of ttl_cache). returns their ratio
+  double removeExpired(timestamp_t timeStamp, double) {
+
+    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
+    currentTime = timeStamp;
+
+    std::size_t beforeSize = kvMap.size();
+    for (auto it = kvMap.begin(); it != kvMap.end(); ) {
+      if (it->second.second < currentTime) it = kvMap.erase(it);
+      else ++it;
+    }
+    return beforeSize == 0 ? 0 : (beforeSize - kvMap.size()) / (double) beforeSize;
+  }
+
 };
 
 
@@ -3,23 +3,150 @@
 
 #include "ttl_cache.hpp"
 #include <chrono> 
+#include <thread> //background reaper
+#include <mutex>
+#include <condition_variable>
+#include <atomic> //time stamp of the coarse clock
+#include <algorithm> //min, max
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(_MSC_VER)
+#include <intrin.h> //rdtsc
+#else
+#include <x86intrin.h> //rdtsc
+#endif
+#endif
+
+
+/* clock policies for realtime_ttl_cache: a struct with a static 'now()' function returning the time
+   elapsed since an arbitrary (fixed) point, as std::chrono::nanoseconds. it must be monotonic
+*/
+
+//reads std::chrono::steady_clock at every call (the default)
+struct realtime_steady_clock {
+  static std::chrono::nanoseconds now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch());
+  }
+};
+
+/* a time stamp shared by the whole process, updated every 'periodMicros' microseconds by a ticker
+   thread (started on the first call), so a read is just a relaxed atomic load.
+   the time lags behind steady_clock by up to one period, which is irrelevant for ttls much longer than it
+*/
+template<long long periodMicros = 1000>
+struct realtime_coarse_clock {
+  static std::chrono::nanoseconds now() {
+    return std::chrono::nanoseconds(ticker().time.load(std::memory_order_relaxed));
+  }
+
+private:
+
+  struct Ticker {
+    std::atomic<long long> time;
+    std::atomic<bool> stopping;
+    std::thread thread;
+    Ticker(): time{realtime_steady_clock::now().count()}, stopping{false} {
+      thread = std::thread([this]() {
+        while (not stopping.load(std::memory_order_relaxed)) {
+          std::this_thread::sleep_for(std::chrono::microseconds(periodMicros));
+          time.store(realtime_steady_clock::now().count(), std::memory_order_relaxed);
+        }
+      });
+    }
+    ~Ticker() {
+      stopping = true;
+      thread.join();
+    }
+  };
+
+  static Ticker& ticker() {
+    static Ticker instance;
+    return instance;
+  }
+};
+
+/* reads the time stamp counter of the processor (rdtsc), which is much cheaper than a system clock call.
+   the counter is converted to nanoseconds with a rate measured against steady_clock on the first call
+   (which takes 'CALIBRATION_MILLIS'). it assumes an invariant TSC (constant rate and synchronized
+   between cores), as in any recent x86 processor. on other architectures, it falls back to steady_clock
+*/
+struct realtime_tsc_clock {
+  static constexpr long long CALIBRATION_MILLIS = 20;
+
+  static std::chrono::nanoseconds now() {
+#if defined(__x86_64__) || defined(__i386__)
+    const Calibration& calibration = calibrate();
+    double elapsedTicks = (double) (long long) (__rdtsc() - calibration.baseTicks);
+    return std::chrono::nanoseconds(calibration.baseNanos + (long long) (elapsedTicks * calibration.nanosPerTick));
+#else
+    return realtime_steady_clock::now();
+#endif
+  }
+
+private:
+
+#if defined(__x86_64__) || defined(__i386__)
+  struct Calibration {
+    unsigned long long baseTicks;
+    long long baseNanos;
+    double nanosPerTick;
+    Calibration() {
+      long long startNanos = realtime_steady_clock::now().count();
+      unsigned long long startTicks = __rdtsc();
+      std::this_thread::sleep_for(std::chrono::milliseconds(CALIBRATION_MILLIS));
+      baseNanos = realtime_steady_clock::now().count();
+      baseTicks = __rdtsc();
+      nanosPerTick = (baseNanos - startNanos) / (double) (baseTicks - startTicks);
+    }
+  };
+
+  static const Calibration& calibrate() {
+    static const Calibration calibration;
+    return calibration;
+  }
+#endif
+};
+
 
 /* wrapper around ttl_cache where time stamps are automatically generated from a real-time clock,
    so the user does not need to pass its own time stamps. 
    by default, TTL values are expressed in ms. This can be changed with the ticsPerSec template argument
    e.g., for microseconds, set it to 1000000.
+
+   the wrapped cache is a ttl_cache by default. it can be replaced by any cache with the same interface
+   and (long long) time stamps, such as the thread-safe sharded_ttl_cache or concurrent_ttl_cache.
+   with a thread-safe cache, 'startReaper' can move the expire algorithm to a background thread
+
+   the clock is read through the Clock policy (see above), so that the cost of reading the time can be
+   traded for precision: realtime_steady_clock (the default), realtime_coarse_clock, or realtime_tsc_clock
     */
-template<class Key, class Value, class HashFunction = std::hash<Key>, long long ticsPerSec = 1000>
+template<class Key, class Value, class HashFunction = std::hash<Key>, long long ticsPerSec = 1000,
+         class Cache = ttl_cache<Key,Value,HashFunction,long long>, class Clock = realtime_steady_clock>
 class realtime_ttl_cache {
 
-  ttl_cache<Key,Value,HashFunction,long long> cache;
+  Cache cache;
+
+  /* background reaper: a thread that calls removeExpired every 'reaperPeriod'.
+     the work bound of each call (maxExamined) adapts to the expired ratio it measures, as in the
+     expire cycle of Redis: it doubles while the ratio stays above the target, and halves otherwise
+  */
+  std::thread reaper;
+  std::mutex reaperMutex;
+  std::condition_variable reaperWakeup;
+  bool reaperStopping;
+  std::size_t reaperBudget;
+
+  static constexpr std::size_t MIN_REAPER_BUDGET = 100;
 
 public:
 
   typedef long long timestamp_t;
 
   realtime_ttl_cache(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction):
-    cache(maxEntries, maxLoadFactor, hashFunction) {}
+    cache(maxEntries, maxLoadFactor, hashFunction),
+    reaperStopping{false},
+    reaperBudget{MIN_REAPER_BUDGET} {}
+
+  ~realtime_ttl_cache() { stopReaper(); }
 
   std::optional<Value> get(const Key& key) {
     return cache.get(key, currentTimeStamp());
@@ -29,23 +156,117 @@ public:
     cache.insert(key, value, currentTimeStamp(), ticsToLive);
   }
 
-  void removeExpired(double targetRatio) {
-    cache.removeExpired(currentTimeStamp(), targetRatio);
+  void insert(Key&& key, Value&& value, timestamp_t ticsToLive) {
+    cache.insert(std::move(key), std::move(value), currentTimeStamp(), ticsToLive);
   }
 
+  //in-place and zero-copy versions of insert and get (see ttl_cache), only available for ttl_cache
+  template<class LookupKey, class... ValueArgs>
+  void emplace(LookupKey&& key, timestamp_t ticsToLive, ValueArgs&&... valueArgs) {
+    cache.emplace(std::forward<LookupKey>(key), currentTimeStamp(), ticsToLive, std::forward<ValueArgs>(valueArgs)...);
+  }
+
+  template<class LookupKey, class... ValueArgs>
+  bool try_emplace(LookupKey&& key, timestamp_t ticsToLive, ValueArgs&&... valueArgs) {
+    return cache.try_emplace(std::forward<LookupKey>(key), currentTimeStamp(), ticsToLive,
+                             std::forward<ValueArgs>(valueArgs)...);
+  }
+
+  template<class Visitor>
+  bool get_with(const Key& key, Visitor&& visitor) {
+    return cache.get_with(key, currentTimeStamp(), std::forward<Visitor>(visitor));
+  }
+
+  /* a key that is not cached is loaded with 'loader' and inserted with 'ticsToLive'. with the thread-safe
+     caches, concurrent misses of the same key only call the loader once (see single_flight.hpp).
+     with 'refreshAhead', keys are reloaded when they expire in at most that many tics
+  */
+  template<class Loader>
+  Value get_or_load(const Key& key, Loader&& loader, timestamp_t ticsToLive, timestamp_t refreshAhead = 0) {
+    return cache.get_or_load(key, currentTimeStamp(), std::forward<Loader>(loader), ticsToLive, refreshAhead);
+  }
+
+  //batched versions of get and insert (see ttl_cache), with a single clock read for the whole batch
+  template<class KeyIterator, class OutputIterator>
+  void get_many(KeyIterator first, KeyIterator last, OutputIterator out) {
+    cache.get_many(first, last, currentTimeStamp(), out);
+  }
+
+  template<class PairIterator>
+  void insert_many(PairIterator first, PairIterator last, timestamp_t ticsToLive) {
+    cache.insert_many(first, last, currentTimeStamp(), ticsToLive);
+  }
+
+  /* snapshots (see ttl_cache), with the remaining ttls in tics. only available for ttl_cache.
+     since the ttls are relative, a snapshot can be loaded by another process, whose clock may differ
+  */
+  template<class... Serializers>
+  std::size_t save(const std::string& path, const Serializers&... serializers) {
+    return cache.save(path, currentTimeStamp(), serializers...);
+  }
+
+  template<class... Serializers>
+  std::size_t load(const std::string& path, const Serializers&... serializers) {
+    return cache.load(path, currentTimeStamp(), serializers...);
+  }
+
+  //fills an empty cache (see ttl_cache), with the ttls in tics. only available for ttl_cache
+  template<class TupleIterator>
+  std::size_t bulk_load(TupleIterator first, TupleIterator last, unsigned int numThreads = 1) {
+    return cache.bulk_load(first, last, currentTimeStamp(), numThreads);
+  }
+
+  //returns the expired ratio of the last sample of the expire algorithm
+  double removeExpired(double targetRatio) {
+    return cache.removeExpired(currentTimeStamp(), targetRatio);
+  }
+
+  /* starts a background thread that runs the expire algorithm every 'period', so that the user's calls
+     do not need to. it requires a thread-safe cache (see is_thread_safe_cache).
+     the reaper is stopped by stopReaper or on destruction
+  */
+  template<class Rep, class Period>
+  void startReaper(std::chrono::duration<Rep, Period> period, double targetRatio) {
+    static_assert(is_thread_safe_cache<Cache>::value, "the background reaper requires a thread-safe cache");
+    if (reaper.joinable()) throw std::logic_error("reaper already running");
+    reaperStopping = false;
+    reaper = std::thread([this, period, targetRatio]() {
+      std::unique_lock<std::mutex> lock(reaperMutex);
+      while (not reaperWakeup.wait_for(lock, period, [this]() { return reaperStopping; })) {
+        std::size_t budget = reaperBudget;
+        lock.unlock();
+        double expiredRatio = cache.removeExpired(currentTimeStamp(), targetRatio, budget);
+        lock.lock();
+        if (expiredRatio > targetRatio) reaperBudget = std::min(2*reaperBudget, std::max(MIN_REAPER_BUDGET, cache.capacity()));
+        else reaperBudget = std::max(reaperBudget/2, MIN_REAPER_BUDGET);
+      }
+    });
+  }
+
+  //waits for the current round of the reaper, if any, to finish
+  void stopReaper() {
+    if (not reaper.joinable()) return;
+    {
+      std::lock_guard<std::mutex> guard(reaperMutex);
+      reaperStopping = true;
+    }
+    reaperWakeup.notify_all();
+    reaper.join();
+  }
+
+  bool reaperRunning() const { return reaper.joinable(); }
+
   //converts real time to a "tick count" with "ticsPerSec" precision
   timestamp_t currentTimeStamp() {
-    auto currentTime = std::chrono::steady_clock::now();
     typedef std::chrono::duration<timestamp_t, std::ratio<1, ticsPerSec>> time_t;
-    auto currentTimePoint = std::chrono::time_point_cast<time_t> (currentTime);
-    return currentTimePoint.time_since_epoch().count();
+    return std::chrono::duration_cast<time_t>(Clock::now()).count();
   }
 
   std::size_t size() const { return cache.size(); } //includes expired entries still in the table
   bool empty() const { return cache.empty(); }
   std::size_t capacity() const { return cache.capacity(); }
   double loadFactor() const { return cache.loadFactor(); }
-  void print() const { cache.print() }
+  void print() const { cache.print(); }
 
 };
 
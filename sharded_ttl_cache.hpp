@@ -0,0 +1,126 @@
+#ifndef SHARDED_TTL_CACHE_H
+#define SHARDED_TTL_CACHE_H
+
+#include "ttl_cache.hpp"
+#include "single_flight.hpp" //get_or_load
+#include "ttl_cache_shards.hpp"
+#include <mutex> //one lock per shard
+#include <algorithm> //max
+
+/* thread-safe wrapper around ttl_cache that partitions the keys into independent shards.
+   each shard is a complete ttl_cache (with its own currentTime, LRU list, and RNG for the expire
+   algorithm) protected by its own mutex, so threads only contend when they access the same shard.
+
+   keys are assigned to shards by the high bits of their hash (see ttl_cache_shard_map),
+   while the tables inside the shards index by the low bits of the hash.
+
+   since each shard keeps its own currentTime, time stamps are only required to be increasing per shard.
+   with several threads, time stamps can reach a shard slightly out of order, so they are clamped
+   to the current time of the shard instead of being rejected as time travel.
+
+   the LRU mechanism is also per shard: maxEntries is split evenly between the shards,
+   and each shard evicts its own least recently used entry when it is full.
+*/
+template<class Key, class Value, class HashFunction = std::hash<Key>, class timestamp_t = long long int>
+class sharded_ttl_cache {
+
+  typedef ttl_cache<Key,Value,HashFunction,timestamp_t> shard_cache_t;
+
+  //aligned to (a typical) cache line so that neighbouring shards do not falsely share their locks
+  struct alignas(64) Shard {
+    std::mutex lock;
+    shard_cache_t cache;
+    Shard(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction):
+      cache(maxEntries, maxLoadFactor, hashFunction) {}
+  };
+
+  ttl_cache_shards<Shard,Key,HashFunction> shards;
+  single_flight_loader<Key,Value,HashFunction,timestamp_t> loads;
+
+public:
+
+  static constexpr std::size_t DEFAULT_SHARD_COUNT = 16;
+
+  //the number of shards must be a power of two
+  sharded_ttl_cache(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction,
+                    std::size_t shardCount = DEFAULT_SHARD_COUNT):
+    shards(maxEntries, maxLoadFactor, hashFunction, shardCount),
+    loads(hashFunction) {}
+
+  std::optional<Value> get(const Key& key, timestamp_t timeStamp) {
+    Shard& shard = shards.shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.cache.get(key, std::max(timeStamp, shard.cache.currentTimeStamp()));
+  }
+
+  void insert(const Key& key, const Value& value, timestamp_t timeStamp, timestamp_t ttl) {
+    Shard& shard = shards.shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.cache.insert(key, value, std::max(timeStamp, shard.cache.currentTimeStamp()), ttl);
+  }
+
+  /* like get, but a key that is not cached is loaded with 'loader' (called with the key) and inserted with
+     'ttl'. concurrent misses of the same key only call the loader once, and with 'refreshAhead', keys are
+     reloaded shortly before they expire (see single_flight.hpp)
+  */
+  template<class Loader>
+  Value get_or_load(const Key& key, timestamp_t timeStamp, Loader&& loader, timestamp_t ttl,
+                    timestamp_t refreshAhead = 0) {
+    auto lookup = [this, timeStamp](const Key& key) -> std::optional<std::pair<Value, timestamp_t>> {
+      Shard& shard = shards.shardFor(key);
+      std::lock_guard<std::mutex> guard(shard.lock);
+      timestamp_t shardTime = std::max(timeStamp, shard.cache.currentTimeStamp());
+      std::optional<Value> value = shard.cache.get(key, shardTime);
+      if (not value) return {};
+      return std::make_pair(std::move(*value), *shard.cache.remaining_ttl(key, shardTime));
+    };
+    auto store = [this, timeStamp, ttl](const Key& key, const Value& value) { insert(key, value, timeStamp, ttl); };
+    return loads.getOrLoad(key, lookup, std::forward<Loader>(loader), store, refreshAhead);
+  }
+
+  /* runs the expire algorithm on each shard in turn, so only one shard is locked at a time.
+     'maxExamined' bounds the work in each shard. returns the average of the expired ratios of the shards
+  */
+  double removeExpired(timestamp_t timeStamp, double targetRatio,
+                       std::size_t maxExamined = std::numeric_limits<std::size_t>::max()) {
+    double expiredRatioSum = 0;
+    for (std::size_t i = 0; i < shards.count(); i++) {
+      Shard& shard = shards[i];
+      std::lock_guard<std::mutex> guard(shard.lock);
+      expiredRatioSum += shard.cache.removeExpired(std::max(timeStamp, shard.cache.currentTimeStamp()),
+                                                   targetRatio, maxExamined);
+    }
+    return expiredRatioSum / shards.count();
+  }
+
+  //aggregated over all the shards. with concurrent writers, the result is only a snapshot
+  std::size_t size() const { return shards.size(); }
+  bool empty() const { return size() == 0; }
+  std::size_t capacity() const { return shards.capacity(); }
+  double loadFactor() const { return size()/(double) capacity(); }
+  std::size_t shardCount() const { return shards.count(); }
+
+  //the most advanced time stamp among the shards
+  timestamp_t currentTimeStamp() const {
+    timestamp_t res = 0;
+    for (std::size_t i = 0; i < shards.count(); i++) {
+      std::lock_guard<std::mutex> guard(shards[i].lock);
+      res = std::max(res, shards[i].cache.currentTimeStamp());
+    }
+    return res;
+  }
+
+  void print() const {
+    for (std::size_t i = 0; i < shards.count(); i++) {
+      std::lock_guard<std::mutex> guard(shards[i].lock);
+      std::cout<<"Shard "<<i<<": ";
+      shards[i].cache.print();
+    }
+  }
+
+};
+
+template<class Key, class Value, class HashFunction, class timestamp_t>
+struct is_thread_safe_cache<sharded_ttl_cache<Key,Value,HashFunction,timestamp_t>> : std::true_type {};
+
+#endif /* SHARDED_TTL_CACHE_H */
@@ -0,0 +1,303 @@
+#ifndef SHARED_TTL_CACHE_H
+#define SHARED_TTL_CACHE_H
+
+#include "ttl_cache.hpp"
+#include "ttl_cache_shards.hpp" //the partitioning of the keys
+#include <atomic> //initialization flag of the shared memory
+#include <string>
+#include <thread> //waiting for another process to initialize the shared memory
+#include <chrono>
+#include <cstdint>
+#include <cstring> //comparing layouts
+#include <typeinfo> //the type fingerprint of the layout
+#include <cerrno>
+#include <algorithm> //max
+#include <pthread.h> //process-shared locks
+#include <sys/mman.h> //shm_open, mmap
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* thread-safe cache that lives in a POSIX shared memory object, so that several processes on the same host
+   (e.g., the worker processes of a server) share a single copy of the cached pairs.
+
+   as in sharded_ttl_cache, the keys are partitioned into shards, each of them a ttl_cache protected by its
+   own lock, but the locks are process-shared pthread mutexes, and the shards are placed in the shared
+   memory together with their tables. the shards use inline storage and RELATIVE_POINTERS, so there are no
+   addresses in the shared memory, and each process can map it at a different address.
+
+   the first process that opens a name creates the shared memory object and initializes it. the others wait
+   until it is initialized, and check that it was created with the same parameters and types (the sizes,
+   and the names of the types given by typeid, which are the same in processes built by the same compiler).
+   the object outlives the processes that use it, until it is removed with 'remove'.
+
+   keys and values must be trivially copyable. the hash function is also stored in the shared memory, so it
+   must be trivially copyable too, and give the same hashes in every process (as std::hash of integers).
+   time stamps must come from a clock shared by the processes, such as steady_clock on Linux. as in
+   sharded_ttl_cache, they are clamped to the current time of each shard.
+   if a process dies while it holds the lock of a shard, the next process that takes the lock clears
+   the shard, since the interrupted operation may have left it inconsistent (with robust mutexes, on Linux)
+*/
+template<class Key, class Value, class HashFunction = std::hash<Key>, class timestamp_t = long long int>
+class shared_ttl_cache {
+
+  struct shard_options : ttl_cache_options {
+    static constexpr bool INLINE_STORAGE = true;
+    static constexpr bool RELATIVE_POINTERS = true;
+  };
+  typedef ttl_cache<Key,Value,HashFunction,timestamp_t,shard_options> shard_cache_t;
+  static_assert(std::is_trivially_copyable<HashFunction>::value,
+                "the hash function of a shared cache must be trivially copyable");
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "the initialization flag must be lock-free");
+
+  //aligned to (a typical) cache line so that neighbouring shards do not falsely share their locks.
+  //each shard is followed by the arrays of its table
+  static constexpr std::size_t ALIGNMENT = 64;
+  struct alignas(ALIGNMENT) Shard {
+    pthread_mutex_t lock;
+    shard_cache_t cache;
+    Shard(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction, void* arrays):
+      cache(maxEntries, maxLoadFactor, hashFunction, arrays) {}
+  };
+
+  //everything that determines the memory layout, so that processes can check that they agree on it
+  struct Layout {
+    uint64_t keySize, valueSize, timestampSize, shardSize;
+    uint64_t typeFingerprint; //of the key, value, time stamp and hash function types
+    uint64_t shardCount, maxEntriesPerShard, shardStride, totalSize;
+    double maxLoadFactor;
+  };
+
+  //at the start of the shared memory. 'ready' is set last, by the process that initializes the rest
+  struct alignas(ALIGNMENT) Header {
+    std::atomic<uint64_t> ready;
+    Layout layout;
+  };
+  static constexpr uint64_t READY = 0x4552414853435454ull; //"TTCSHARE"
+
+  static constexpr std::chrono::seconds INIT_TIMEOUT{10};
+
+  //locks a shard for its lifetime
+  class ShardLock {
+    Shard& shard;
+  public:
+    ShardLock(const shared_ttl_cache& owner, Shard& shard): shard{shard} {
+      int res = pthread_mutex_lock(&shard.lock);
+#if defined(__linux__)
+      if (res == EOWNERDEAD) {
+        owner.resetShard(shard);
+        pthread_mutex_consistent(&shard.lock);
+        res = 0;
+      }
+#else
+      (void) owner;
+#endif
+      if (res != 0) throw std::runtime_error("cannot lock a shard of the shared cache");
+    }
+    ~ShardLock() { pthread_mutex_unlock(&shard.lock); }
+  };
+
+  const HashFunction hashFunction;
+  ttl_cache_shard_map map;
+  Layout layout;
+  char* region; //the mapping of the shared memory in this process
+
+public:
+
+  static constexpr std::size_t DEFAULT_SHARD_COUNT = 16;
+
+  /* opens the shared cache called 'name' (a POSIX shared memory name, such as "/my_cache"), creating it
+     if it does not exist. the parameters are as for sharded_ttl_cache, and they must be the same in every
+     process that opens it. the number of shards must be a power of two
+  */
+  shared_ttl_cache(const std::string& name, std::size_t maxEntries, double maxLoadFactor,
+                   const HashFunction& hashFunction, std::size_t shardCount = DEFAULT_SHARD_COUNT):
+    hashFunction{hashFunction},
+    map(shardCount),
+    region{nullptr}
+  {
+    if (maxLoadFactor < 0.01) throw std::invalid_argument("Load factor too low");
+
+    std::size_t maxEntriesPerShard = map.maxEntriesPerShard(maxEntries);
+    layout = Layout{sizeof(Key), sizeof(Value), sizeof(timestamp_t), sizeof(Shard), typeFingerprint(),
+                    shardCount, maxEntriesPerShard,
+                    roundUp(sizeof(Shard) + shard_cache_t::relativeArraysSize(maxEntriesPerShard, maxLoadFactor)), 0,
+                    maxLoadFactor};
+    layout.totalSize = sizeof(Header) + shardCount * layout.shardStride;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool creator = fd >= 0;
+    if (not creator) {
+      if (errno != EEXIST) throw std::runtime_error("cannot create shared memory " + name);
+      fd = shm_open(name.c_str(), O_RDWR, 0600);
+      if (fd < 0) throw std::runtime_error("cannot open shared memory " + name);
+      //the creator sets the size before it initializes the memory
+      auto deadline = std::chrono::steady_clock::now() + INIT_TIMEOUT;
+      struct stat info;
+      while (fstat(fd, &info) == 0 and info.st_size == 0 and std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      if ((uint64_t) info.st_size != layout.totalSize) {
+        close(fd);
+        throw std::invalid_argument("shared memory " + name + " was created with other parameters");
+      }
+    } else if (ftruncate(fd, layout.totalSize) != 0) {
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::runtime_error("cannot allocate shared memory " + name);
+    }
+
+    void* address = mmap(nullptr, layout.totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+      if (creator) shm_unlink(name.c_str());
+      throw std::runtime_error("cannot map shared memory " + name);
+    }
+    region = static_cast<char*>(address);
+
+    if (creator) {
+      try {
+        initialize();
+      } catch (...) {
+        munmap(region, layout.totalSize);
+        shm_unlink(name.c_str());
+        throw;
+      }
+      return;
+    }
+
+    Header& header = *reinterpret_cast<Header*>(region);
+    auto deadline = std::chrono::steady_clock::now() + INIT_TIMEOUT;
+    while (header.ready.load(std::memory_order_acquire) != READY) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        munmap(region, layout.totalSize);
+        throw std::runtime_error("shared memory " + name + " was not initialized");
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (std::memcmp(&header.layout, &layout, sizeof(Layout)) != 0) {
+      munmap(region, layout.totalSize);
+      throw std::invalid_argument("shared memory " + name + " was created with other parameters");
+    }
+  }
+
+  shared_ttl_cache(const shared_ttl_cache&) = delete;
+  shared_ttl_cache& operator=(const shared_ttl_cache&) = delete;
+
+  //unmaps the shared memory. the cache stays, for the other processes and the ones that open it later
+  ~shared_ttl_cache() {
+    munmap(region, layout.totalSize);
+  }
+
+  //destroys the shared cache called 'name'. the processes that have it open can still use it
+  static bool remove(const std::string& name) {
+    return shm_unlink(name.c_str()) == 0;
+  }
+
+  std::optional<Value> get(const Key& key, timestamp_t timeStamp) {
+    Shard& shard = shardFor(key);
+    ShardLock guard(*this, shard);
+    return shard.cache.get(key, std::max(timeStamp, shard.cache.currentTimeStamp()));
+  }
+
+  void insert(const Key& key, const Value& value, timestamp_t timeStamp, timestamp_t ttl) {
+    Shard& shard = shardFor(key);
+    ShardLock guard(*this, shard);
+    shard.cache.insert(key, value, std::max(timeStamp, shard.cache.currentTimeStamp()), ttl);
+  }
+
+  /* runs the expire algorithm on each shard in turn, so only one shard is locked at a time.
+     'maxExamined' bounds the work in each shard. returns the average of the expired ratios of the shards
+  */
+  double removeExpired(timestamp_t timeStamp, double targetRatio,
+                       std::size_t maxExamined = std::numeric_limits<std::size_t>::max()) {
+    double expiredRatioSum = 0;
+    for (std::size_t i = 0; i < shardCount(); i++) {
+      Shard& shard = shardAt(i);
+      ShardLock guard(*this, shard);
+      expiredRatioSum += shard.cache.removeExpired(std::max(timeStamp, shard.cache.currentTimeStamp()),
+                                                   targetRatio, maxExamined);
+    }
+    return expiredRatioSum / shardCount();
+  }
+
+  //aggregated over all the shards. with concurrent writers, the result is only a snapshot
+  std::size_t size() const {
+    std::size_t res = 0;
+    for (std::size_t i = 0; i < shardCount(); i++) {
+      Shard& shard = shardAt(i);
+      ShardLock guard(*this, shard);
+      res += shard.cache.size();
+    }
+    return res;
+  }
+  bool empty() const { return size() == 0; }
+  std::size_t capacity() const {
+    std::size_t res = 0;
+    for (std::size_t i = 0; i < shardCount(); i++) res += shardAt(i).cache.capacity(); //constant, no need to lock
+    return res;
+  }
+  double loadFactor() const { return size()/(double) capacity(); }
+  std::size_t shardCount() const { return layout.shardCount; }
+  std::size_t memorySize() const { return layout.totalSize; } //in bytes, shared by all the processes
+
+private:
+
+  //FNV-1a hash of the names of the types, so that the same bytes are not read as other types of the same size
+  static uint64_t typeFingerprint() {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char* name : {typeid(Key).name(), typeid(Value).name(), typeid(timestamp_t).name(),
+                             typeid(HashFunction).name()}) {
+      for (; *name != '\0'; name++) hash = (hash ^ (unsigned char) *name) * 0x100000001b3ull;
+      hash = (hash ^ 0xff) * 0x100000001b3ull; //separator, so that the boundaries between names matter
+    }
+    return hash;
+  }
+
+  static std::size_t roundUp(const std::size_t bytes) {
+    return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+
+  inline Shard& shardAt(const std::size_t index) const {
+    return *reinterpret_cast<Shard*>(region + sizeof(Header) + index * layout.shardStride);
+  }
+
+  inline void* arraysOf(Shard& shard) const {
+    return reinterpret_cast<char*>(&shard) + sizeof(Shard);
+  }
+
+  //done by the process that created the shared memory, before any other process can use it
+  void initialize() {
+    Header* header = new (region) Header();
+    header->layout = layout;
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+#if defined(__linux__)
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+#endif
+    for (std::size_t i = 0; i < shardCount(); i++) {
+      Shard* shard = reinterpret_cast<Shard*>(region + sizeof(Header) + i * layout.shardStride);
+      new (shard) Shard(layout.maxEntriesPerShard, layout.maxLoadFactor, hashFunction, arraysOf(*shard));
+      pthread_mutex_init(&shard->lock, &attributes);
+    }
+    pthread_mutexattr_destroy(&attributes);
+    header->ready.store(READY, std::memory_order_release);
+  }
+
+  //replaces the cache of a shard by an empty one. the lock of the shard must be held
+  void resetShard(Shard& shard) const {
+    shard.cache.~shard_cache_t();
+    new (&shard.cache) shard_cache_t(layout.maxEntriesPerShard, layout.maxLoadFactor, hashFunction, arraysOf(shard));
+  }
+
+  inline Shard& shardFor(const Key& key) const {
+    return shardAt(map.shardIndex(hashFunction(key)));
+  }
+
+};
+
+template<class Key, class Value, class HashFunction, class timestamp_t>
+struct is_thread_safe_cache<shared_ttl_cache<Key,Value,HashFunction,timestamp_t>> : std::true_type {};
+
+#endif /* SHARED_TTL_CACHE_H */
@@ -0,0 +1,82 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <mutex>
+#include <future> //the callers waiting for a load share its future
+#include <unordered_map> //the loads in flight, by key
+#include <optional>
+#include <utility>
+#include <exception>
+
+/* coalesces the loads of missing keys of a thread-safe cache ("single flight"), for the get_or_load
+   functions of sharded_ttl_cache and concurrent_ttl_cache. when several threads miss the same key at the
+   same time (e.g., when a hot key expires), only the first one runs the loader (e.g., a request to the
+   backend), and the others wait for its result instead of all calling the backend at once.
+
+   with 'refreshAhead', a key that is cached but expires within 'refreshAhead' time units is reloaded
+   before it expires ("stale-while-revalidate"): the first caller that sees it in that window reloads it,
+   and the other callers get the cached value meanwhile without waiting. since the cache has no threads
+   of its own, the reload runs in the thread of that caller
+
+   the map of loads in flight is protected by a single mutex, which is only taken on misses and refreshes
+*/
+template<class Key, class Value, class HashFunction, class timestamp_t>
+class single_flight_loader {
+
+  std::mutex lock;
+  std::unordered_map<Key, std::shared_future<Value>, HashFunction> flights;
+
+public:
+
+  single_flight_loader(const HashFunction& hashFunction): flights(0, hashFunction) {}
+
+  /* 'lookup' reads the key from the cache, returning its value and its remaining ttl, if it is cached.
+     'loader' gets the value of a key that is not cached (or is being refreshed), and 'store' inserts it
+     into the cache. an exception thrown by the loader is rethrown to all the callers waiting for it,
+     and nothing is cached
+  */
+  template<class Lookup, class Loader, class Store>
+  Value getOrLoad(const Key& key, const Lookup& lookup, Loader&& loader, const Store& store,
+                  const timestamp_t refreshAhead) {
+    std::optional<std::pair<Value, timestamp_t>> cached = lookup(key);
+    if (cached and cached->second > refreshAhead) return std::move(cached->first);
+
+    std::promise<Value> promise;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      auto flight = flights.find(key);
+      if (flight != flights.end()) {
+        //a refresh does not wait for the one in flight, since there is a value
+        if (cached) return std::move(cached->first);
+        std::shared_future<Value> future = flight->second;
+        guard.unlock();
+        return future.get();
+      }
+      flights.emplace(key, promise.get_future().share());
+    }
+
+    try {
+      //a load that finished just before this one started may have cached the key already
+      std::optional<std::pair<Value, timestamp_t>> current = cached ? std::nullopt : lookup(key);
+      Value value = current ? std::move(current->first) : loader(key);
+      if (not current) store(key, value);
+      finish(key);
+      promise.set_value(value);
+      return value;
+    } catch (...) {
+      finish(key);
+      promise.set_exception(std::current_exception());
+      throw;
+    }
+  }
+
+private:
+
+  void finish(const Key& key) {
+    std::lock_guard<std::mutex> guard(lock);
+    flights.erase(key);
+  }
+
+};
+
+#endif /* SINGLE_FLIGHT_H */
@@ -1,15 +1,30 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <algorithm>
+#include <tuple>
+#include <set>
 
 #include <chrono>
 #include <random>
 
 #include <cassert>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <cstdio>
+#include <cstring>
 
 #include "ttl_cache.hpp"
 #include "dummy_cache.hpp"
 #include "realtime_ttl_cache.hpp"
+#include "sharded_ttl_cache.hpp"
+#include "concurrent_ttl_cache.hpp"
+#include "shared_ttl_cache.hpp"
+#include "ttl_cache_trace.hpp"
+#include "tiered_ttl_cache.hpp"
+#include <sys/wait.h> //the shared cache is tested with a child process
 
 /* sequence of operations to test the LRU mechanism.
    All the timestamps are set so no keys expire, so TTL does not interfere
@@ -86,8 +101,11 @@ void TTL_testcase() {
    with randomized parameters to test the cache under a variety of situations
    the results are compared against "dummy_cache", a trivial implementation of a cache
    run with VERBOSE off in ttl_cache!
+   the tested cache type can be changed to test other configurations of ttl_cache
+   (some configurations allow a higher max load factor)
 */
-void automatedCorrectnessTest() {
+template<class Cache = ttl_cache<int, int>>
+void automatedCorrectnessTest(double maxLoadFactor = 0.5) {
 
   std::mt19937_64 RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())};
 
@@ -108,14 +126,14 @@ void automatedCorrectnessTest() {
     int minTTL = 1 + RNG()%5;
     int maxTTL = minTTL + RNG()%10000;
     std::size_t cacheMaxSize = numTotalKeys / (1+ RNG()%5);
-    double loadFactor = 0.1 * (1 + RNG()%5);
+    double loadFactor = maxLoadFactor * (1 + RNG()%5) / 5;
     int readWriteRatio = 1 + RNG()%2; 
 
     std::cout<<">>>> Test with "<<numTotalKeys<<" keys, "<<cacheMaxSize<<" max cache size, "
              <<loadFactor<<" load factor"<<std::endl;
 
     //tested data structure and ground truth
-    ttl_cache<int, int> cache(cacheMaxSize, loadFactor, std::hash<int>());
+    Cache cache(cacheMaxSize, loadFactor, std::hash<int>());
     dummy_cache<int, int> trueMap;
 
     //analytics, could add many more
@@ -216,9 +234,1180 @@ void realTimeCacheTest() {
   }
 }
 
+/* each clock policy of realtime_ttl_cache must follow real time (within its precision),
+   and entries must expire after their ttl (here in ms)
+*/
+template<class Clock>
+void clockPolicyTest(const std::string& name) {
+  realtime_ttl_cache<int, int, std::hash<int>, 1000, ttl_cache<int, int>, Clock> cache(100, 0.5, std::hash<int>());
+  auto startTime = cache.currentTimeStamp();
+  cache.insert(1, 1, 30);
+  cache.insert(2, 2, 100000);
+  assert(cache.get(1) == 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  auto elapsed = cache.currentTimeStamp() - startTime;
+  std::cout<<name<<": slept 60 ms, measured "<<elapsed<<" ms"<<std::endl;
+  assert(elapsed >= 50 and elapsed < 1000); //the coarse clock lags by up to one period
+  assert(!cache.get(1) and cache.get(2) == 2);
+}
+
+void clockPoliciesTest() {
+  clockPolicyTest<realtime_steady_clock>("steady clock");
+  clockPolicyTest<realtime_coarse_clock<>>("coarse clock");
+  clockPolicyTest<realtime_tsc_clock>("tsc clock");
+}
+
+/* removeExpired with a bound on the number of examined entries:
+   each call only removes a few of the expired entries, but repeated calls remove all of them
+   (until the load factor is too low for random sampling)
+*/
+void removeExpiredBudgetTest() {
+  std::mt19937_64 RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())};
+
+  std::size_t maxEntries = 10000;
+  ttl_cache<int, int> cache(maxEntries, 0.5, std::hash<int>());
+  while (cache.size() < maxEntries) cache.insert(RNG()%1000000000, 0, 1, 10); //random keys, to avoid long clusters
+
+  std::size_t maxExamined = 100;
+  double expiredRatio = cache.removeExpired(20, 0.25, maxExamined);
+  assert(expiredRatio == 1.0);
+  assert(cache.size() < maxEntries);
+  assert(cache.size() > maxEntries - 1000);
+
+  int numCalls = 1;
+  while (cache.loadFactor() >= 0.1) {
+    cache.removeExpired(20, 0.25, maxExamined);
+    numCalls++;
+  }
+  std::cout<<"removed "<<maxEntries - cache.size()<<" expired entries in "<<numCalls
+           <<" calls examining at most "<<maxExamined<<" entries each"<<std::endl;
+}
+
+/* the batched operations must behave exactly like the same sequence of single get/insert calls */
+void batchedOperationsTest() {
+  std::mt19937_64 RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())};
+
+  int numTotalKeys = 3000;
+  std::size_t cacheMaxSize = 1000;
+  ttl_cache<int, int> singleCache(cacheMaxSize, 0.4, std::hash<int>());
+  ttl_cache<int, int> batchCache(cacheMaxSize, 0.4, std::hash<int>());
+
+  long long currentTime = 0;
+  for (int round = 0; round < 2000; round++) {
+    currentTime += 1 + RNG()%10;
+    int batchSize = 1 + RNG()%100;
+    if (RNG()%2 == 0) {
+      std::vector<std::pair<int,int>> pairs;
+      for (int i = 0; i < batchSize; i++) pairs.push_back({(int) (RNG()%numTotalKeys), (int) (RNG()%1000)});
+      long long ttl = 1 + RNG()%500;
+      for (auto& pair : pairs) singleCache.insert(pair.first, pair.second, currentTime, ttl);
+      batchCache.insert_many(pairs.begin(), pairs.end(), currentTime, ttl);
+    } else {
+      std::vector<int> keys;
+      for (int i = 0; i < batchSize; i++) keys.push_back(RNG()%numTotalKeys);
+      std::vector<std::optional<int>> values;
+      batchCache.get_many(keys.begin(), keys.end(), currentTime, std::back_inserter(values));
+      assert(values.size() == keys.size());
+      for (int i = 0; i < batchSize; i++) assert(singleCache.get(keys[i], currentTime) == values[i]);
+    }
+  }
+  assert(singleCache.LRU_order() == batchCache.LRU_order());
+
+  realtime_ttl_cache<int, int> realtimeCache(cacheMaxSize, 0.4, std::hash<int>());
+  std::vector<std::pair<int,int>> pairs = {{1, 10}, {2, 20}, {3, 30}};
+  realtimeCache.insert_many(pairs.begin(), pairs.end(), 100000);
+  std::vector<int> keys = {3, 4, 1};
+  std::vector<std::optional<int>> values(keys.size());
+  realtimeCache.get_many(keys.begin(), keys.end(), values.begin());
+  assert(values[0] == 30 and !values[1] and values[2] == 10);
+}
+
+struct inline_options : ttl_cache_options { static constexpr bool INLINE_STORAGE = true; };
+
+/* the same random sequence of operations is applied to a cache with the default storage
+   and to one with inline storage. they must behave identically, including the LRU order
+*/
+void inlineStorageTest() {
+  std::mt19937_64 RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())};
+
+  int numOperations = 200000;
+  int numTotalKeys = 500;
+  std::size_t cacheMaxSize = 200;
+  double loadFactor = 0.4;
+
+  ttl_cache<int, int> nodeCache(cacheMaxSize, loadFactor, std::hash<int>());
+  ttl_cache<int, int, std::hash<int>, long long, inline_options> inlineCache(cacheMaxSize, loadFactor, std::hash<int>());
+
+  long long currentTime = 0;
+  for (int j = 0; j < numOperations; j++) {
+    currentTime += 1 + RNG()%3;
+    int key = RNG()%numTotalKeys;
+    if (RNG()%3 == 0) {
+      int value = RNG()%1000000;
+      long long ttl = 1 + RNG()%2000;
+      nodeCache.insert(key, value, currentTime, ttl);
+      inlineCache.insert(key, value, currentTime, ttl);
+    } else {
+      assert(nodeCache.get(key, currentTime) == inlineCache.get(key, currentTime));
+    }
+  }
+  assert(nodeCache.size() == inlineCache.size());
+  assert(nodeCache.LRU_order() == inlineCache.LRU_order());
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, inline_options>>();
+}
+
+struct pow2_options : ttl_cache_options { static constexpr bool POW2_CAPACITY = true; };
+struct pow2_inline_options : pow2_options { static constexpr bool INLINE_STORAGE = true; };
+
+/* the capacity is rounded up to a power of two, but the cache still holds at most maxEntries pairs.
+   sequential keys with the identity std::hash<int> should be spread by the hash finalizer
+*/
+void pow2CapacityTest() {
+  std::size_t maxEntries = 1000;
+  ttl_cache<int, int, std::hash<int>, long long, pow2_options> cache(maxEntries, 0.3, std::hash<int>());
+  assert((cache.capacity() & (cache.capacity()-1)) == 0);
+  assert(cache.capacity() >= maxEntries/0.3);
+
+  for (int i = 0; i < 5000; i++) {
+    cache.insert(i, i, i+1, 1000000);
+    assert(cache.size() <= maxEntries);
+  }
+  assert(cache.size() == maxEntries);
+  for (int i = 4000; i < 5000; i++) assert(cache.get(i, 6000) == i);
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, pow2_options>>();
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, pow2_inline_options>>();
+}
+
+struct robin_hood_options : ttl_cache_options { static constexpr bool ROBIN_HOOD = true; };
+
+/* Robin Hood probing allows load factors up to 0.9
+   the cache is filled up to its maximum size, and then all the keys must still be found
+*/
+void robinHoodTest() {
+  std::size_t maxEntries = 10000;
+  ttl_cache<int, int, std::hash<int>, long long, robin_hood_options> cache(maxEntries, 0.9, std::hash<int>());
+
+  for (int i = 0; i < (int) maxEntries; i++) cache.insert(i, -i, i+1, 1000000);
+  assert(cache.size() == maxEntries);
+  assert(cache.loadFactor() > 0.89);
+  for (int i = 0; i < (int) maxEntries; i++) assert(cache.get(i, maxEntries+1) == -i);
+  for (int i = maxEntries; i < 2*(int) maxEntries; i++) assert(!cache.get(i, maxEntries+1));
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, robin_hood_options>>(0.9);
+}
+
+struct lazy_get_options : ttl_cache_options { static constexpr bool LAZY_GET = true; };
+struct lazy_get_robin_hood_options : robin_hood_options { static constexpr bool LAZY_GET = true; };
+struct lazy_get_inline_options : inline_options { static constexpr bool LAZY_GET = true; };
+
+/* with LAZY_GET, get does not remove expired entries: they are left in place until
+   an insert in the same cluster, an LRU eviction, or removeExpired reclaims them
+*/
+template<class Options>
+void lazyGetTest() {
+  ttl_cache<int, int, std::hash<int>, long long, Options> cache(100, 0.5, std::hash<int>());
+  for (int i = 0; i < 100; i++) cache.insert(i, i, i+1, 50);
+  for (int i = 99; i >= 0; i--) assert((bool) cache.get(i, 101) == (i+1+50 > 101));
+  assert(cache.size() == 100); //the expired entries are still there
+  //the hits still move their pairs to the end of the LRU order (in the table, with inline storage)
+  std::vector<int> order = cache.LRU_order();
+  assert(order.size() == 100 and order[50] == 50 and order[51] == 99 and order.back() == 51);
+  cache.removeExpired(102, 0.01);
+  assert(cache.size() < 100);
+  for (int i = 52; i < 100; i++) assert(cache.get(i, 102) == i);
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, Options>>();
+}
+
+void lazyGetTests() {
+  lazyGetTest<lazy_get_options>();
+  lazyGetTest<lazy_get_inline_options>();
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, lazy_get_robin_hood_options>>(0.9);
+}
+
+struct timer_wheel_options : ttl_cache_options { static constexpr bool TIMER_WHEEL = true; };
+
+/* removeExpiredUntil removes exactly the expired entries, even at low load factors
+   where the sampling algorithm of removeExpired gives up
+*/
+void timerWheelTest() {
+  std::mt19937_64 RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())};
+
+  std::size_t maxEntries = 10000;
+  ttl_cache<int, int, std::hash<int>, long long, timer_wheel_options> cache(maxEntries, 0.5, std::hash<int>());
+  std::vector<long long> expireTimes(maxEntries);
+  for (int i = 0; i < (int) maxEntries; i++) {
+    long long ttl = 1 + RNG()%100000;
+    cache.insert(i, i, 1, ttl);
+    expireTimes[i] = 1 + ttl;
+  }
+
+  for (long long time = 2; time < 110000; time += 1 + RNG()%5000) {
+    cache.removeExpiredUntil(time);
+    std::size_t alive = std::count_if(expireTimes.begin(), expireTimes.end(),
+                                      [time](long long expireTime) { return expireTime > time; });
+    assert(cache.size() == alive);
+  }
+  assert(cache.empty());
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, timer_wheel_options>>();
+}
+
+struct jitter_options : timer_wheel_options { static constexpr double TTL_JITTER = 0.2; };
+struct hashed_jitter_options : jitter_options { static constexpr bool HASHED_JITTER = true; };
+struct hashed_mixed_jitter_options : hashed_jitter_options { static constexpr bool HASH_MIXER = true; };
+
+/* a batch inserted with the same ttl expires spread over the jitter interval, and removeExpiredUntil
+   with a budget removes the expired entries over several calls. with HASHED_JITTER, a key always
+   gets the same ttl, whatever the hash seed of the cache
+*/
+void ttlJitterTest() {
+  int numEntries = 10000;
+  ttl_cache<int, int, std::hash<int>, long long, jitter_options> cache(numEntries, 0.5, std::hash<int>());
+  for (int i = 0; i < numEntries; i++) cache.insert(i, i, 1, 1000);
+
+  //the ttls are in [801, 1000]
+  assert(cache.removeExpiredUntil(801) and cache.size() == (std::size_t) numEntries);
+  assert(cache.removeExpiredUntil(901));
+  assert(cache.size() > 0.3*numEntries and cache.size() < 0.7*numEntries);
+
+  std::size_t maxRemoved = 100;
+  int calls = 0;
+  std::size_t beforeSize = cache.size();
+  while (not cache.removeExpiredUntil(1001, maxRemoved)) {
+    calls++;
+    assert(beforeSize - cache.size() >= maxRemoved and cache.size() < beforeSize);
+    beforeSize = cache.size();
+  }
+  assert(cache.empty() and calls >= 0.3*numEntries/maxRemoved);
+
+  ttl_cache<int, int, std::hash<int>, long long, hashed_jitter_options> hashedCache(100, 0.5, std::hash<int>());
+  ttl_cache<int, int, std::hash<int>, long long, hashed_mixed_jitter_options> otherCache(100, 0.5, std::hash<int>());
+  std::set<long long> ttls;
+  for (int i = 0; i < 50; i++) {
+    hashedCache.insert(i, i, 1, 1000);
+    otherCache.insert(i, i, 1, 1000);
+    long long ttl = *hashedCache.remaining_ttl(i, 1);
+    assert(ttl > 800 and ttl <= 1000 and ttl == *otherCache.remaining_ttl(i, 1));
+    ttls.insert(ttl);
+  }
+  assert(ttls.size() > 25);
+  otherCache.reseed();
+  for (int i = 0; i < 50; i++) {
+    otherCache.insert(i, i, 2, 1000);
+    assert(*otherCache.remaining_ttl(i, 2) == *hashedCache.remaining_ttl(i, 1));
+  }
+  std::cout<<"ttl jitter: "<<calls+1<<" budgeted removeExpiredUntil calls"<<std::endl;
+}
+
+struct stats_options : ttl_cache_options { static constexpr bool STATS = true; };
+struct stats_robin_hood_options : robin_hood_options { static constexpr bool STATS = true; };
+
+/* the counters of the STATS option for a small scripted sequence, with the identity hash
+   (capacity 8, so key k has ideal position k%8). then, the expire algorithm on a larger cache
+*/
+template<class Options>
+void statsTest() {
+  ttl_cache<int, int, std::hash<int>, long long, Options> cache(4, 0.5, std::hash<int>());
+  cache.insert(0, 0, 1, 5);
+  cache.insert(8, 8, 1, 100); //displaced to position 1
+  assert(cache.get(8, 10) == 8); //0 expired: removed, and 8 relocated to position 0
+  cache.insert(8, 80, 10, 100);
+  for (int i = 1; i <= 3; i++) cache.insert(i, i, 10, 100);
+  cache.insert(4, 4, 10, 100); //the cache is full: 8 is evicted
+  //examines positions 1 to 5: 1, 2, 3, 4, and an empty one (with Robin Hood, it stops early at 2)
+  assert(!cache.get(9, 10));
+
+  ttl_cache_stats stats = cache.stats();
+  assert(stats.gets == 2 and stats.hits == 1 and stats.misses == 1);
+  assert(stats.inserts == 6 and stats.updates == 1);
+  assert(stats.expirations == 1 and stats.evictions == 1);
+  assert(stats.relocations >= 1);
+  assert(stats.probeLengthHistogram[ttl_cache_stats::histogramBucket(Options::ROBIN_HOOD ? 2 : 5)] >= 1);
+  assert(stats.clusterLengthHistogram[ttl_cache_stats::histogramBucket(4)] == 1);
+
+  std::mt19937_64 RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())};
+  ttl_cache<int, int, std::hash<int>, long long, Options> largeCache(10000, 0.5, std::hash<int>());
+  while (largeCache.size() < 10000) largeCache.insert(RNG()%1000000000, 0, 1, RNG()%2 == 0 ? 10 : 1000);
+  largeCache.removeExpired(20, 0.25);
+  stats = largeCache.stats();
+  assert(stats.expireCalls == 1 and stats.expireRounds >= 1);
+  assert(stats.expireRemoved == 10000 - largeCache.size());
+  assert(stats.expireSampled >= stats.expireRemoved);
+  assert(stats.lastExpiredRatio <= 0.25);
+  std::cout<<"removeExpired: "<<stats.expireRounds<<" rounds, sampled "<<stats.expireSampled
+           <<" entries, removed "<<stats.expireRemoved<<", average probe length "<<stats.averageProbeLength()<<std::endl;
+
+  largeCache.resetStats();
+  assert(largeCache.stats().gets == 0 and largeCache.stats().expireCalls == 0);
+}
+
+struct clock_options : ttl_cache_options { static constexpr bool CLOCK_EVICTION = true; };
+struct clock_inline_robin_hood_options : robin_hood_options {
+  static constexpr bool CLOCK_EVICTION = true;
+  static constexpr bool INLINE_STORAGE = true;
+};
+
+/* with CLOCK_EVICTION, the evicted entry is the first one after the hand that was not used
+   since it was inserted (with the identity hash, key k is at position k here)
+*/
+void clockEvictionTest() {
+  ttl_cache<int, int, std::hash<int>, long long, clock_options> cache(4, 0.5, std::hash<int>());
+  for (int i = 0; i < 4; i++) cache.insert(i, i, 1, 100);
+  for (int i = 0; i < 3; i++) assert(cache.get(i, 2) == i);
+  cache.insert(4, 4, 3, 100); //the hand clears the bits of 1 and 2, and evicts 3
+  assert(!cache.get(3, 4));
+  for (int i : {0, 1, 2, 4}) assert(cache.get(i, 4) == i);
+  assert(cache.size() == 4);
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, clock_options>>();
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, clock_inline_robin_hood_options>>(0.9);
+}
+
+struct tiny_lfu_options : ttl_cache_options { static constexpr bool TINY_LFU = true; };
+struct tiny_lfu_inline_robin_hood_options : robin_hood_options {
+  static constexpr bool TINY_LFU = true;
+  static constexpr bool INLINE_STORAGE = true;
+};
+
+/* a scan of keys read only once flushes the hot keys out of a plain LRU cache,
+   but with TINY_LFU, the scanned keys are rejected when they leave the window
+*/
+void tinyLfuTest() {
+  std::size_t maxEntries = 1000;
+  ttl_cache<int, int> lruCache(maxEntries, 0.5, std::hash<int>());
+  ttl_cache<int, int, std::hash<int>, long long, tiny_lfu_options> lfuCache(maxEntries, 0.5, std::hash<int>());
+
+  long long time = 0;
+  auto access = [&time](auto& cache, int key) {
+    time++;
+    if (cache.get(key, time)) return true;
+    cache.insert(key, key, time, 1000000);
+    return false;
+  };
+
+  int numHotKeys = 500;
+  for (int round = 0; round < 5; round++) {
+    for (int key = 0; key < numHotKeys; key++) {
+      access(lruCache, key);
+      access(lfuCache, key);
+    }
+  }
+  for (int key = numHotKeys; key < numHotKeys + 3000; key++) {
+    access(lruCache, key);
+    access(lfuCache, key);
+  }
+  int lruHits = 0, lfuHits = 0;
+  for (int key = 0; key < numHotKeys; key++) {
+    lruHits += access(lruCache, key);
+    lfuHits += access(lfuCache, key);
+  }
+  std::cout<<"hot keys still cached after a scan: "<<lruHits<<" with LRU, "<<lfuHits<<" with TinyLFU"<<std::endl;
+  assert(lruHits == 0);
+  assert(lfuHits > 0.9 * numHotKeys);
+  assert(lfuCache.size() == maxEntries);
+
+  //an expired victim makes room without a duel, so the live pairs stay
+  ttl_cache<int, int, std::hash<int>, long long, tiny_lfu_options> smallCache(2, 0.5, std::hash<int>());
+  smallCache.insert(1, 1, 0, 1);
+  smallCache.insert(2, 2, 0, 100);
+  smallCache.insert(3, 3, 5, 100);
+  assert(smallCache.get(2, 6) == 2 and smallCache.get(3, 6) == 3);
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, tiny_lfu_options>>();
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, tiny_lfu_inline_robin_hood_options>>(0.9);
+}
+
+//transparent hash: std::string_view (and string literals) have the same hash as the equal strings
+struct transparent_string_hash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+};
+
+//string key that counts how many times it is constructed from a lookup key
+struct counted_string : std::string {
+  static int constructions;
+  explicit counted_string(std::string_view s): std::string(s) { constructions++; }
+};
+int counted_string::constructions = 0;
+
+/* with a transparent hash function, string_view lookups do not construct keys:
+   only an insert that adds a new pair does
+*/
+void transparentLookupTest() {
+  ttl_cache<counted_string, int, transparent_string_hash> cache(10, 0.5, transparent_string_hash());
+  std::string_view key1 = "key1", key2 = "key2";
+  cache.insert(key1, 1, 1, 100);
+  assert(counted_string::constructions == 1);
+  assert(cache.get(key1, 2) == 1);
+  assert(cache.peek(key1, 2) == 1);
+  assert(!cache.get(key2, 2));
+  cache.insert(key1, 2, 3, 100); //update of an existing pair
+  assert(counted_string::constructions == 1);
+  assert(cache.get("key1", 4) == 2);
+  assert(cache.get(counted_string(key1), 4) == 2);
+  assert(counted_string::constructions == 2); //the one constructed just above
+  cache.insert(key2, 3, 5, 100);
+  assert(counted_string::constructions == 3);
+  assert(!cache.get(key1, 200));
+
+  ttl_cache<std::string, int, transparent_string_hash, long long, robin_hood_options> rhCache(10, 0.9, transparent_string_hash());
+  for (int i = 0; i < 10; i++) rhCache.insert(std::to_string(i), i, 1, 100);
+  for (int i = 0; i < 10; i++) assert(rhCache.get(std::string_view(std::to_string(i)), 2) == i);
+}
+
+struct monitor_options : ttl_cache_options { static constexpr bool PROBE_MONITOR = true; };
+struct mixed_monitor_options : monitor_options { static constexpr bool HASH_MIXER = true; };
+//thresholds that ordinary windows exceed, so that the table is reseeded as often as allowed
+struct reseeding_options : mixed_monitor_options {
+  static constexpr double PROBE_ALARM_AVERAGE = 1;
+  static constexpr bool REBUILD_ON_ALARM = true;
+};
+struct reseeding_inline_robin_hood_options : robin_hood_options {
+  static constexpr bool INLINE_STORAGE = true;
+  static constexpr bool CONTROL_BYTES = true;
+  static constexpr bool PROBE_MONITOR = true;
+  static constexpr bool HASH_MIXER = true;
+  static constexpr double PROBE_ALARM_AVERAGE = 1;
+  static constexpr bool REBUILD_ON_ALARM = true;
+};
+
+//keys that are multiples of the capacity all have the same ideal position, without mixing
+template<class Options>
+ttl_cache_probe_report strideProbeReport() {
+  ttl_cache<int, int, std::hash<int>, long long, Options> cache(1000, 0.5, std::hash<int>());
+  int stride = cache.capacity();
+  for (int i = 0; i < 500; i++) cache.insert(i*stride, i, 1, 1000000);
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 500; i++) assert(cache.get(i*stride, 2) == i);
+  }
+  return cache.probeReport();
+}
+
+/* the probe length monitor raises alarms for keys that collide with the identity hash, and the hash mixer
+   spreads them. with REBUILD_ON_ALARM, the table is reseeded at most once per size() searches, and the
+   rebuilds keep the pairs
+*/
+void probeMonitorTest() {
+  ttl_cache_probe_report identity = strideProbeReport<monitor_options>();
+  ttl_cache_probe_report mixed = strideProbeReport<mixed_monitor_options>();
+  assert(identity.alarms > 0 and identity.averageProbeLength > 100 and identity.maxProbeLength >= 500);
+  assert(mixed.alarms == 0 and mixed.averageProbeLength < 2 and identity.reseeds == 0);
+
+  ttl_cache<int, int, std::hash<int>, long long, reseeding_options> cache(2000, 0.5, std::hash<int>());
+  for (int i = 0; i < 1000; i++) cache.insert(i, i, 1, 1000000);
+  int numSearches = 0;
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 1000; i++, numSearches++) assert(cache.get(i, 2) == i);
+    cache.insert(round, round, 2, 1000000); //the pending reseeds run on insertions
+  }
+  ttl_cache_probe_report report = cache.probeReport();
+  assert(report.reseeds > 0 and report.reseeds <= (std::size_t) numSearches/cache.size());
+  assert(cache.size() == 1000 and cache.LRU_order().size() == 1000);
+
+  //a manual reseed of a POW2 table keeps the LRU order and the expire times
+  ttl_cache<int, int, std::hash<int>, long long, pow2_options> pow2Cache(100, 0.5, std::hash<int>());
+  for (int i = 0; i < 100; i++) pow2Cache.insert(i, i, 1, 10 + i);
+  std::vector<int> order = pow2Cache.LRU_order();
+  pow2Cache.reseed();
+  assert(pow2Cache.LRU_order() == order);
+  assert(pow2Cache.get(60, 70) == 60 and !pow2Cache.get(59, 70));
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, reseeding_options>>();
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, reseeding_inline_robin_hood_options>>(0.8);
+  std::cout<<"probe monitor: average probe length "<<identity.averageProbeLength<<" with the identity hash, "
+           <<mixed.averageProbeLength<<" mixed; "<<report.reseeds<<" reseeds"<<std::endl;
+}
+
+//value that counts how many times it is copied (moves are not counted)
+struct counted_value {
+  static int copies;
+  std::string data;
+  counted_value(std::string data): data{std::move(data)} {}
+  counted_value(const counted_value& other): data{other.data} { copies++; }
+  counted_value(counted_value&&) = default;
+  counted_value& operator=(const counted_value& other) { data = other.data; copies++; return *this; }
+  counted_value& operator=(counted_value&&) = default;
+};
+int counted_value::copies = 0;
+std::ostream& operator<<(std::ostream& os, const counted_value& value) { return os<<value.data; }
+
+//rvalues are moved into the cache, emplace constructs values in place, and get_with does not copy them
+void moveAwareInsertTest() {
+  ttl_cache<std::string, counted_value> cache(10, 0.5, std::hash<std::string>());
+  cache.insert("key1", counted_value("a"), 1, 100);
+  cache.insert(std::string("key1"), counted_value("b"), 2, 100); //update
+  cache.emplace("key2", 3, 100, "c");
+  assert(!cache.try_emplace("key2", 4, 100, "d")); //already cached
+  assert(cache.try_emplace("key3", 5, 100, "e"));
+  assert(counted_value::copies == 0);
+
+  std::string seen;
+  auto visitor = [&seen](const counted_value& value) { seen += value.data; };
+  assert(cache.get_with("key1", 6, visitor));
+  assert(cache.get_with("key2", 6, visitor));
+  assert(cache.get_with(std::string("key3"), 6, visitor));
+  assert(!cache.get_with("key4", 6, visitor));
+  assert(seen == "bce");
+  assert(counted_value::copies == 0);
+
+  counted_value value("f");
+  cache.insert("key4", value, 7, 100);
+  assert(counted_value::copies == 1);
+  assert(cache.get("key4", 8)->data == "f");
+  assert(counted_value::copies == 2);
+  assert(!cache.get_with("key1", 200, visitor)); //expired
+
+  //the ttl of an existing key is not changed by try_emplace
+  ttl_cache<int, int, std::hash<int>, long long, inline_options> inlineCache(10, 0.5, std::hash<int>());
+  inlineCache.emplace(1, 1, 10, 1);
+  assert(!inlineCache.try_emplace(1, 2, 100, 2));
+  assert(inlineCache.get(1, 5) == 1);
+  assert(!inlineCache.get(1, 11));
+}
+
+//the weight of a pair is the length of its value
+struct string_length_weigher {
+  std::size_t operator()(const int&, const std::string& value) const { return value.size(); }
+};
+struct weighted_options : ttl_cache_options { typedef string_length_weigher WEIGHER; };
+struct weighted_tiny_lfu_options : weighted_options { static constexpr bool TINY_LFU = true; };
+struct weighted_clock_options : weighted_options { static constexpr bool CLOCK_EVICTION = true; };
+
+//with a WEIGHER, pairs are evicted when their total weight exceeds the limit, even if there is room for more pairs
+void weightedCacheTest() {
+  ttl_cache<int, std::string, std::hash<int>, long long, weighted_options> cache(100, 0.5, std::hash<int>(), 100);
+  for (int i = 0; i < 10; i++) cache.insert(i, std::string(20, 'a'), i+1, 1000);
+  assert(cache.size() == 5 and cache.weight() == 100);
+  for (int i = 5; i < 10; i++) assert(cache.get(i, 20));
+
+  cache.insert(9, std::string(60, 'b'), 21, 1000); //update, the 2 least recently used pairs are evicted
+  assert(cache.size() == 3 and cache.weight() == 100);
+  assert(!cache.get(6, 22) and cache.get(7, 22) and cache.get(8, 22) and cache.get(9, 22));
+
+  cache.insert(10, std::string(101, 'c'), 23, 1000); //too heavy, not cached
+  assert(!cache.get(10, 24));
+  assert(cache.size() == 3 and cache.weight() == 100);
+
+  cache.insert(11, std::string(5, 'd'), 25, 10); //evicts 7. expired pairs still count until they are removed
+  assert(cache.size() == 3 and cache.weight() == 85);
+  assert(!cache.get(11, 100)); //removes it
+  assert(cache.weight() == 80);
+
+  //the other eviction policies choose other pairs to evict, but also keep the weight within the limit
+  auto fill = [](auto& cache) {
+    for (int i = 0; i < 2000; i++) {
+      cache.insert(i % 60, std::string(i % 35, 'e'), i+1, 1000);
+      assert(cache.weight() <= cache.maxWeight());
+    }
+    assert(cache.weight() > cache.maxWeight() / 2);
+  };
+  ttl_cache<int, std::string, std::hash<int>, long long, weighted_tiny_lfu_options> lfuCache(100, 0.5, std::hash<int>(), 100);
+  ttl_cache<int, std::string, std::hash<int>, long long, weighted_clock_options> clockCache(100, 0.5, std::hash<int>(), 100);
+  fill(lfuCache);
+  fill(clockCache);
+}
+
+struct growable_options : ttl_cache_options { static constexpr bool GROWABLE_TABLE = true; };
+struct growable_inline_robin_hood_options : robin_hood_options {
+  static constexpr bool GROWABLE_TABLE = true;
+  static constexpr bool INLINE_STORAGE = true;
+  static constexpr bool TIMER_WHEEL = true;
+};
+
+//rebuilding the table, by resize or by growing it on demand, keeps the LRU order and the expire times
+template<class Options>
+void resizeTest() {
+  typedef ttl_cache<int, int, std::hash<int>, long long, Options> cache_t;
+  std::size_t maxEntries = 1000;
+  cache_t cache(maxEntries, 0.5, std::hash<int>());
+  std::size_t initialCapacity = cache.capacity();
+  std::vector<int> expectedOrder;
+  for (int i = 0; i < 500; i++) {
+    cache.insert(i, i, 1, i % 2 == 0 ? 100 : 1000);
+    expectedOrder.push_back(i);
+  }
+  for (int i = 0; i < 500; i += 3) {
+    assert(cache.get(i, 2) == i);
+    expectedOrder.erase(std::find(expectedOrder.begin(), expectedOrder.end(), i));
+    expectedOrder.push_back(i);
+  }
+  if (Options::GROWABLE_TABLE) assert(initialCapacity < cache.capacity() and cache.capacity() < maxEntries / 0.5);
+  else assert(initialCapacity == cache.capacity());
+  assert(cache.LRU_order() == expectedOrder);
+
+  cache.resize(200); //only the 200 most recently used pairs stay
+  expectedOrder.erase(expectedOrder.begin(), expectedOrder.end() - 200);
+  assert(cache.size() == 200 and cache.maxSize() == 200);
+  assert(cache.LRU_order() == expectedOrder);
+  assert(cache.capacity() <= 400);
+
+  cache.resize(2000);
+  cache.reserve(2000);
+  assert(cache.maxSize() == 2000 and cache.capacity() >= 4000);
+  assert(cache.LRU_order() == expectedOrder);
+  for (int key : expectedOrder) assert(cache.get(key, 3) == key);
+  if constexpr (Options::TIMER_WHEEL) {
+    cache.removeExpiredUntil(500);
+    assert(cache.size() == (std::size_t) std::count_if(expectedOrder.begin(), expectedOrder.end(),
+                                                       [](int key) { return key % 2 == 1; }));
+  }
+  for (int key : expectedOrder) assert(cache.get(key, 500).has_value() == (key % 2 == 1));
+
+  automatedCorrectnessTest<cache_t>(Options::ROBIN_HOOD ? 0.9 : 0.5);
+}
+
+struct control_bytes_options : ttl_cache_options { static constexpr bool CONTROL_BYTES = true; };
+struct control_bytes_inline_pow2_options : control_bytes_options {
+  static constexpr bool INLINE_STORAGE = true;
+  static constexpr bool POW2_CAPACITY = true;
+};
+
+void controlBytesTest() {
+  //a table smaller than a group of control bytes: the groups wrap around it several times
+  ttl_cache<int, int, std::hash<int>, long long, control_bytes_options> smallCache(2, 0.5, std::hash<int>());
+  assert(smallCache.capacity() == 4);
+  smallCache.insert(3, 3, 1, 100);
+  smallCache.insert(7, 7, 1, 100); //same ideal position, wraps around to position 0
+  assert(smallCache.get(7, 2) == 7 and smallCache.get(3, 2) == 3 and !smallCache.get(11, 2));
+  assert(!smallCache.get(3, 200) and !smallCache.get(7, 200));
+  assert(smallCache.empty());
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, control_bytes_options>>();
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, control_bytes_inline_pow2_options>>();
+}
+
+struct compact_options : ttl_cache_options { static constexpr bool COMPACT_ENTRIES = true; };
+struct compact_coarse_options : compact_options { static constexpr double COMPACT_RESOLUTION = 10; };
+struct compact_inline_wheel_options : compact_options {
+  static constexpr bool INLINE_STORAGE = true;
+  static constexpr bool TIMER_WHEEL = true;
+};
+
+void compactEntriesTest() {
+  //expire times are rounded up to a whole tick
+  ttl_cache<int, int, std::hash<int>, long long, compact_coarse_options> coarseCache(10, 0.5, std::hash<int>());
+  coarseCache.insert(1, 1, 1, 5);
+  assert(coarseCache.get(1, 9) == 1);
+  assert(!coarseCache.get(1, 10));
+
+  //the epoch moves forward when the time gets more than 2^31 ticks away from it
+  ttl_cache<int, int, std::hash<int>, long long, compact_inline_wheel_options> cache(10, 0.5, std::hash<int>());
+  long long farTime = 3000000000ll;
+  cache.insert(1, 1, 0, 1000000000000ll); //capped to 2^32-2 ticks
+  cache.insert(2, 2, 0, 10);
+  cache.insert(3, 3, farTime, 100); //moves the epoch
+  assert(cache.get(1, farTime) == 1);
+  assert(!cache.get(2, farTime));
+  assert(cache.get(3, farTime + 99) == 3);
+  cache.removeExpiredUntil(farTime + 100);
+  assert(cache.size() == 1);
+  assert(!cache.get(1, 5000000000ll));
+
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, compact_options>>();
+  automatedCorrectnessTest<ttl_cache<int, int, std::hash<int>, long long, compact_inline_wheel_options>>();
+}
+
+struct string_serializer {
+  std::size_t size(const std::string& s) const { return s.size(); }
+  void write(const std::string& s, char* out) const { std::memcpy(out, s.data(), s.size()); }
+  std::string read(const char* in, std::size_t size) const { return std::string(in, size); }
+};
+
+//a snapshot restores the pairs that were alive, with their LRU order and remaining ttls, at a later time
+template<class Options>
+void snapshotTest() {
+  const std::string path = "ttl_cache_snapshot_test.bin";
+  typedef ttl_cache<int, int, std::hash<int>, long long, Options> cache_t;
+  cache_t cache(1000, 0.5, std::hash<int>());
+  std::vector<int> expectedOrder;
+  for (int i = 0; i < 500; i++) cache.insert(i, i, 1, i % 5 == 0 ? 10 : 1000 + i);
+  for (int i = 0; i < 500; i += 3) assert(cache.get(i, 11).has_value() == (i % 5 != 0));
+  for (int i = 0; i < 500; i++) if (i % 3 != 0 and i % 5 != 0) expectedOrder.push_back(i);
+  for (int i = 0; i < 500; i += 3) if (i % 5 != 0) expectedOrder.push_back(i);
+  assert(cache.save(path, 11) == 400);
+
+  cache_t restored(1000, 0.5, std::hash<int>());
+  assert(restored.load(path, 1000000) == 400);
+  assert(restored.LRU_order() == expectedOrder);
+  for (int i = 0; i < 500; i++) {
+    //inserted at time 1, saved at time 11: the remaining ttl was 1000+i-10
+    assert(restored.get(i, 1000000 + 1000 + i - 11).has_value() == (i % 5 != 0));
+    assert(!restored.get(i, 1000000 + 1000 + i - 10));
+  }
+
+  //a smaller cache only keeps the most recently used pairs
+  cache_t smallCache(100, 0.5, std::hash<int>());
+  assert(smallCache.load(path, 20) == 100);
+  assert(smallCache.LRU_order() == std::vector<int>(expectedOrder.end() - 100, expectedOrder.end()));
+  bool thrown = false;
+  try { smallCache.load(path, 20); } catch (const std::invalid_argument&) { thrown = true; }
+  assert(thrown); //not empty
+  std::remove(path.c_str());
+}
+
+void snapshotsTest() {
+  snapshotTest<ttl_cache_options>();
+  snapshotTest<growable_inline_robin_hood_options>();
+  snapshotTest<compact_inline_wheel_options>();
+
+  //other types need a serializer
+  const std::string path = "ttl_cache_snapshot_test.bin";
+  ttl_cache<std::string, std::string> cache(10, 0.5, std::hash<std::string>());
+  cache.insert("key1", "value1", 1, 100);
+  cache.insert("key2", std::string(1000, 'a'), 1, 100);
+  assert(cache.save(path, 2, string_serializer(), string_serializer()) == 2);
+  ttl_cache<std::string, std::string> restored(10, 0.5, std::hash<std::string>());
+  assert(restored.load(path, 2, string_serializer(), string_serializer()) == 2);
+  assert(restored.get("key1", 3) == "value1" and restored.get("key2", 3) == std::string(1000, 'a'));
+
+  //an int cache cannot load it
+  ttl_cache<int, int> intCache(10, 0.5, std::hash<int>());
+  bool thrown = false;
+  try { intCache.load(path, 1); } catch (const std::runtime_error&) { thrown = true; }
+  assert(thrown);
+  std::remove(path.c_str());
+}
+
+//a bulk load places the pairs in the order of the range, as if they had been inserted one by one
+template<class Options>
+void bulkLoadTest() {
+  typedef ttl_cache<int, int, std::hash<int>, long long, Options> cache_t;
+  std::vector<std::tuple<int, int, long long>> pairs;
+  for (int i = 0; i < 50000; i++) pairs.emplace_back((i * 7919) % 50000, i, 1 + i % 1000);
+  std::vector<int> expectedOrder;
+  for (auto& pair : pairs) expectedOrder.push_back(std::get<0>(pair));
+
+  for (unsigned int numThreads : {1, 4}) {
+    cache_t cache(100000, Options::ROBIN_HOOD ? 0.9 : 0.5, std::hash<int>());
+    assert(cache.bulk_load(pairs.begin(), pairs.end(), 10, numThreads) == 50000);
+    if constexpr (not Options::CLOCK_EVICTION) assert(cache.LRU_order() == expectedOrder);
+    for (auto& [key, value, ttl] : pairs) assert(cache.peek(key, 10 + ttl - 1) == value and !cache.peek(key, 10 + ttl));
+    for (auto& [key, value, ttl] : pairs) assert(!cache.get(key, 10 + 1000));
+    assert(cache.empty());
+  }
+
+  //with more pairs than maxEntries, only the last ones are cached
+  cache_t smallCache(1000, 0.5, std::hash<int>());
+  assert(smallCache.bulk_load(pairs.begin(), pairs.end(), 1) == 1000);
+  for (std::size_t i = 0; i < pairs.size(); i++) {
+    assert(smallCache.peek(std::get<0>(pairs[i]), 1).has_value() == (i >= pairs.size() - 1000));
+  }
+}
+
+void bulkLoadTests() {
+  bulkLoadTest<ttl_cache_options>();
+  bulkLoadTest<growable_inline_robin_hood_options>();
+  bulkLoadTest<clock_options>();
+  bulkLoadTest<control_bytes_inline_pow2_options>();
+
+  //the tuples are moved with move iterators, and repeated keys are updated
+  std::vector<std::tuple<std::string, std::string, long long>> pairs = {
+    {"key1", std::string(100, 'a'), 10}, {"key2", std::string(100, 'b'), 10}, {"key1", std::string(100, 'c'), 20}};
+  ttl_cache<std::string, std::string> cache(10, 0.5, std::hash<std::string>());
+  assert(cache.bulk_load(std::make_move_iterator(pairs.begin()), std::make_move_iterator(pairs.end()), 1) == 2);
+  assert(std::get<1>(pairs[0]).empty() and std::get<1>(pairs[2]).empty());
+  assert(cache.LRU_order() == std::vector<std::string>({"key2", "key1"}));
+  assert(cache.get("key2", 5) == std::string(100, 'b') and cache.get("key1", 15) == std::string(100, 'c'));
+}
+
+/* a trace recorded from a ttl_cache replays to the same results on a cache with the same options and seed,
+   and the hits of a smaller cache are also hits of the oracle (dummy_cache), with the same values.
+   a realtime_ttl_cache records the time stamps of its clock
+*/
+void traceReplayTest() {
+  const std::string path = "ttl_cache_trace_test.bin";
+  std::mt19937_64 RNG{1};
+  ttl_cache<int, int> cache(100, 0.5, std::hash<int>());
+  cache.seedRandom(42);
+  std::size_t numOperations = 20000, recordedHits = 0;
+  {
+    ttl_cache_recorder<int, int, ttl_cache<int, int>> recorder(cache, path);
+    long long timeStamp = 1;
+    for (std::size_t i = 0; i < numOperations; i++) {
+      timeStamp += RNG()%3;
+      int key = RNG()%300;
+      if (i % 100 == 99) recorder.removeExpired(timeStamp, 0.25);
+      else if (RNG()%2 == 0) recordedHits += recorder.get(key, timeStamp).has_value();
+      else recorder.insert(key, (int) i, timeStamp, 1 + RNG()%200);
+    }
+  }
+
+  std::vector<ttl_cache_trace_record<int, int>> records = ttl_cache_read_trace<int, int>(path);
+  assert(records.size() == numOperations);
+  assert(records[99].op == ttl_cache_trace_op::removeExpired and records[99].targetRatio == 0.25);
+
+  ttl_cache<int, int> replayed(100, 0.5, std::hash<int>());
+  replayed.seedRandom(42);
+  ttl_cache_replay_result result = ttl_cache_replay(records, replayed);
+  assert(result.operations == numOperations and result.hits == recordedHits and result.divergences == 0);
+  assert(replayed.size() == cache.size() and replayed.LRU_order() == cache.LRU_order());
+
+  dummy_cache<int, int> oracle;
+  std::vector<std::optional<int>> oracleResults(records.size());
+  ttl_cache_replay_result oracleResult = ttl_cache_replay(records, oracle,
+    [&oracleResults](std::size_t i, const std::optional<int>& value) { oracleResults[i] = value; });
+  ttl_cache<int, int, std::hash<int>, long long, clock_options> smallCache(50, 0.5, std::hash<int>());
+  int wrongHits = 0;
+  ttl_cache_replay_result smallResult = ttl_cache_replay(records, smallCache,
+    [&oracleResults, &wrongHits](std::size_t i, const std::optional<int>& value) {
+      if (value and value != oracleResults[i]) wrongHits++;
+    });
+  assert(wrongHits == 0 and smallResult.hits <= oracleResult.hits and result.hits <= oracleResult.hits);
+
+  realtime_ttl_cache<int, int> realtimeCache(100, 0.5, std::hash<int>());
+  {
+    ttl_cache_recorder<int, int, realtime_ttl_cache<int, int>> recorder(realtimeCache, path);
+    recorder.insert(1, 10, 3600000);
+    assert(recorder.get(1) == 10 and !recorder.get(2));
+    recorder.removeExpired(0.25);
+  }
+  records = ttl_cache_read_trace<int, int>(path);
+  assert(records.size() == 4 and records[0].op == ttl_cache_trace_op::insert and records[0].ttl == 3600000);
+  assert(records[1].hit and !records[2].hit and records[3].timeStamp >= records[0].timeStamp);
+  std::remove(path.c_str());
+  std::cout<<"trace replay: hit ratios "<<smallResult.hitRatio()<<" (CLOCK, half size), "<<result.hitRatio()
+           <<" (recorded), "<<oracleResult.hitRatio()<<" (oracle)"<<std::endl;
+}
+
+//removal listener that records the notifications
+struct removal_event {
+  int key, value;
+  long long expireTime;
+  ttl_cache_removal_cause cause;
+};
+struct removal_recorder {
+  std::vector<removal_event> events;
+  void operator()(const int& key, int& value, long long expireTime, ttl_cache_removal_cause cause) {
+    events.push_back({key, value, expireTime, cause});
+  }
+};
+template<class Base>
+struct listener_options : Base { typedef removal_recorder REMOVAL_LISTENER; };
+
+/* the listener is called once for each removed pair, with its value and its expire time, whether it is
+   evicted, expired, or erased
+*/
+template<class Options>
+void removalListenerTest() {
+  ttl_cache<int, int, std::hash<int>, long long, listener_options<Options>> cache(4, 0.5, std::hash<int>());
+  std::vector<removal_event>& events = cache.removalListener().events;
+  for (int k = 1; k <= 5; k++) cache.insert(k, 10*k, k, 100);
+  assert(events.size() == 1 and events[0].cause == ttl_cache_removal_cause::evicted);
+  int evicted = events[0].key;
+  assert(events[0].value == 10*evicted and events[0].expireTime == evicted + 100);
+  assert(!cache.peek(evicted, 5) and cache.size() == 4);
+
+  for (int k = 1; k <= 5; k++) assert(!cache.get(k, 1000));
+  assert(cache.size() == 0 and events.size() == 5);
+  std::set<int> removed;
+  for (std::size_t i = 1; i < events.size(); i++) {
+    assert(events[i].cause == ttl_cache_removal_cause::expired);
+    assert(events[i].value == 10*events[i].key and events[i].expireTime == events[i].key + 100);
+    removed.insert(events[i].key);
+  }
+  removed.insert(evicted);
+  assert(removed.size() == 5);
+
+  cache.insert(6, 60, 1001, 100);
+  assert(cache.erase(6, 1002) and !cache.erase(6, 1003) and !cache.get(6, 1003));
+  assert(events.size() == 6 and events[5].cause == ttl_cache_removal_cause::erased);
+  assert(events[5].key == 6 and events[5].expireTime == 1101);
+  cache.insert(7, 70, 1004, 1);
+  assert(!cache.erase(7, 1005) and events.size() == 6); //expired, not erased
+
+  //an expired pair taken by the eviction policy is notified as expired
+  ttl_cache<int, int, std::hash<int>, long long, listener_options<Options>> small(2, 0.5, std::hash<int>());
+  std::vector<removal_event>& smallEvents = small.removalListener().events;
+  small.insert(1, 10, 0, 1);
+  small.insert(2, 20, 0, 100);
+  small.insert(3, 30, 5, 100);
+  assert(smallEvents.size() == 1 and smallEvents[0].key == 1 and smallEvents[0].expireTime == 1);
+  assert(smallEvents[0].cause == ttl_cache_removal_cause::expired);
+  assert(small.get(2, 6) == 20 and small.get(3, 6) == 30);
+}
+
+void removalListenerTests() {
+  removalListenerTest<ttl_cache_options>();
+  removalListenerTest<clock_options>();
+  removalListenerTest<robin_hood_options>();
+  removalListenerTest<inline_options>();
+  removalListenerTest<tiny_lfu_options>();
+}
+
+/* live pairs evicted from the first tier are demoted to the second one, and promoted back on a hit with
+   their remaining ttl. expired pairs are not demoted, and an insertion replaces the copy in the second tier
+*/
+void tieredCacheTest() {
+  tiered_ttl_cache<int, int> cache(3, 10, 0.5, std::hash<int>());
+  for (int k = 1; k <= 3; k++) cache.insert(k, 10*k, 1, 100);
+  cache.insert(4, 40, 2, 100);
+  assert(cache.firstTierSize() == 3 and cache.secondTierSize() == 1 and cache.demotions() == 1);
+
+  assert(cache.get(1, 50) == 10); //promoted, demoting 2
+  assert(cache.promotions() == 1 and cache.demotions() == 2);
+  assert(cache.firstTierSize() == 3 and cache.secondTierSize() == 1);
+
+  cache.insert(2, 21, 60, 1000); //demotes 3, and drops the old value of 2
+  assert(cache.get(2, 61) == 21 and cache.secondTierSize() == 1 and cache.promotions() == 1);
+
+  assert(!cache.get(1, 101) and !cache.get(3, 101)); //expired in the first and the second tier
+  assert(cache.demotions() == 3 and cache.promotions() == 1);
+  assert(cache.get(2, 102) == 21);
+
+  //other types need a codec, e.g., with a serializer
+  typedef ttl_cache_serializing_codec<std::string, string_serializer> string_codec;
+  tiered_ttl_cache<int, std::string, std::hash<int>, long long, ttl_cache_options, ttl_cache_options, string_codec>
+    stringCache(2, 10, 0.5, std::hash<int>());
+  for (int k = 0; k < 10; k++) stringCache.insert(k, std::string(k, 'a'), 1, 100);
+  assert(stringCache.firstTierSize() == 2 and stringCache.secondTierSize() == 8);
+  for (int k = 0; k < 10; k++) assert(stringCache.get(k, 2) == std::string(k, 'a'));
+  assert(stringCache.promotions() == 10 and stringCache.size() == 10);
+}
+
+/* several threads insert and read back disjoint sets of keys concurrently
+   the cache is large enough that no key should be evicted, so every read must hit
+   compile with -pthread
+*/
+void shardedCacheTest() {
+  int numThreads = 8;
+  int keysPerThread = 1000;
+  std::size_t shardCount = 16;
+  sharded_ttl_cache<int, int> cache(4*numThreads*keysPerThread, 0.5, std::hash<int>(), shardCount);
+
+  std::vector<std::thread> threads;
+  std::vector<int> wrongReads(numThreads, 0);
+  for (int t = 0; t < numThreads; t++) {
+    threads.emplace_back([&cache, &wrongReads, t, keysPerThread]() {
+      long long timeStamp = 0;
+      for (int k = t*keysPerThread; k < (t+1)*keysPerThread; k++) {
+        cache.insert(k, 2*k, ++timeStamp, 1000000);
+      }
+      for (int round = 0; round < 10; round++) {
+        for (int k = t*keysPerThread; k < (t+1)*keysPerThread; k++) {
+          auto value = cache.get(k, ++timeStamp);
+          if (!value or *value != 2*k) wrongReads[t]++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  for (int t = 0; t < numThreads; t++) assert(wrongReads[t] == 0);
+  assert(cache.size() == (std::size_t) numThreads*keysPerThread);
+  std::cout<<"sharded cache: "<<cache.size()<<" entries in "<<cache.shardCount()
+           <<" shards (load factor "<<cache.loadFactor()<<")"<<std::endl;
+}
+
+/* reader threads look up keys while writer threads keep updating them
+   every value written for key k is k*1000 + (the writer's round), so a torn read would show up as a
+   value that does not belong to its key. at the end, the last round of every key must be found
+   compile with -pthread
+*/
+void concurrentCacheTest() {
+  //peek does not change the cache
+  ttl_cache<int, int> singleCache(10, 0.5, std::hash<int>());
+  for (int i = 0; i < 3; i++) singleCache.insert(i, i, 1, 10);
+  std::vector<int> order = singleCache.LRU_order();
+  assert(singleCache.peek(0, 5) == 0 and !singleCache.peek(5, 5) and !singleCache.peek(1, 11));
+  assert(singleCache.LRU_order() == order and singleCache.size() == 3 and singleCache.currentTimeStamp() == 1);
+
+  int numWriters = 2, numReaders = 6;
+  int numKeys = 4000, numRounds = 200;
+  concurrent_ttl_cache<int, int> cache(4*numKeys, 0.5, std::hash<int>());
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+  std::vector<int> wrongReads(numReaders, 0), hits(numReaders, 0);
+  for (int t = 0; t < numWriters; t++) {
+    threads.emplace_back([&cache, t, numWriters, numKeys, numRounds]() {
+      long long timeStamp = 0;
+      for (int round = 0; round < numRounds; round++) {
+        for (int k = t; k < numKeys; k += numWriters) cache.insert(k, k*1000 + round, ++timeStamp, 1000000000);
+      }
+    });
+  }
+  for (int t = 0; t < numReaders; t++) {
+    threads.emplace_back([&cache, &done, &wrongReads, &hits, t, numKeys]() {
+      std::mt19937_64 RNG{(uint64_t) t};
+      while (!done.load()) {
+        int k = RNG()%numKeys;
+        auto value = cache.get(k, 1);
+        if (value) {
+          hits[t]++;
+          if (*value / 1000 != k) wrongReads[t]++;
+        }
+      }
+    });
+  }
+  for (int t = 0; t < numWriters; t++) threads[t].join();
+  done = true;
+  for (int t = numWriters; t < numWriters + numReaders; t++) threads[t].join();
+
+  for (int t = 0; t < numReaders; t++) assert(wrongReads[t] == 0);
+  for (int k = 0; k < numKeys; k++) assert(cache.get(k, 1) == k*1000 + numRounds-1);
+  std::cout<<"concurrent cache: "<<std::accumulate(hits.begin(), hits.end(), 0)<<" hits, "
+           <<cache.size()<<" entries in "<<cache.shardCount()<<" shards"<<std::endl;
+}
+
+/* get_or_load: many threads miss the same keys at the same time with a slow loader, which must be called
+   only once per key. then, refreshAhead reloads a key that is about to expire while the other
+   callers still get the cached value, and a failed load throws to every caller without caching anything
+   compile with -pthread
+*/
+template<class Cache>
+void getOrLoadTest(const std::string& name) {
+  Cache cache(1000, 0.5, std::hash<int>());
+  std::atomic<int> loads{0};
+  auto slowLoader = [&loads](int key) {
+    loads++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return key*2;
+  };
+
+  int numThreads = 8, numKeys = 4;
+  std::vector<std::thread> threads;
+  std::vector<int> wrongReads(numThreads, 0);
+  for (int t = 0; t < numThreads; t++) {
+    threads.emplace_back([&cache, &slowLoader, &wrongReads, t, numKeys]() {
+      for (int k = 0; k < numKeys; k++) {
+        if (cache.get_or_load(k, 1, slowLoader, 100) != k*2) wrongReads[t]++;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (int t = 0; t < numThreads; t++) assert(wrongReads[t] == 0);
+  assert(loads == numKeys and cache.size() == (std::size_t) numKeys);
+
+  //refresh-ahead: key 1 expires at 101
+  auto newLoader = [&loads](int key) { loads++; return key*3; };
+  assert(cache.get_or_load(1, 50, newLoader, 100, 10) == 2 and loads == numKeys);
+  assert(cache.get_or_load(1, 95, newLoader, 100, 10) == 3 and loads == numKeys + 1); //refreshed
+  assert(cache.get(1, 150) == 3); //the refreshed entry lives until 195
+
+  //a failed load is not cached
+  auto failingLoader = [](int) -> int { throw std::runtime_error("backend down"); };
+  bool thrown = false;
+  try { cache.get_or_load(100, 150, failingLoader, 100); } catch (const std::runtime_error&) { thrown = true; }
+  assert(thrown and !cache.get(100, 150));
+  assert(cache.get_or_load(100, 150, newLoader, 100) == 300);
+  std::cout<<name<<" get_or_load: "<<loads<<" loads"<<std::endl;
+}
+
+void getOrLoadTests() {
+  getOrLoadTest<sharded_ttl_cache<int, int>>("sharded");
+  getOrLoadTest<concurrent_ttl_cache<int, int>>("concurrent");
+
+  //the single-threaded cache and the realtime wrapper
+  ttl_cache<int, int> cache(10, 0.5, std::hash<int>());
+  int loads = 0;
+  auto loader = [&loads](int key) { loads++; return key + loads; };
+  assert(cache.get_or_load(1, 1, loader, 10) == 2 and cache.get_or_load(1, 5, loader, 10) == 2);
+  assert(cache.get_or_load(1, 9, loader, 10, 3) == 3 and loads == 2);
+  realtime_ttl_cache<int, int, std::hash<int>, 1000, sharded_ttl_cache<int, int>> realtimeCache(100, 0.5, std::hash<int>());
+  assert(realtimeCache.get_or_load(7, loader, 3600000) == 10 and realtimeCache.get(7) == 10);
+}
+
+/* several processes share a cache: a child process fills it, the parent reads it back through its own
+   mapping (and a second one, at another address). compile with -pthread (and -lrt on older glibc)
+*/
+void sharedCacheTest() {
+  typedef shared_ttl_cache<int, int> cache_t;
+  const std::string name = "/ttl_cache_shared_test";
+  cache_t::remove(name);
+  {
+    cache_t cache(name, 1000, 0.5, std::hash<int>(), 4);
+    pid_t pid = fork();
+    if (pid == 0) {
+      cache_t childCache(name, 1000, 0.5, std::hash<int>(), 4);
+      for (int i = 0; i < 500; i++) childCache.insert(i, i*2, 1, 100);
+      _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) and WEXITSTATUS(status) == 0);
+    assert(cache.size() == 500);
+    for (int i = 0; i < 500; i++) assert(cache.get(i, 2) == i*2);
+
+    cache_t otherMapping(name, 1000, 0.5, std::hash<int>(), 4);
+    otherMapping.insert(1000, 1, 3, 100);
+    assert(cache.get(1000, 4) == 1);
+    assert(!otherMapping.get(0, 200)); //expired
+
+    bool thrown = false;
+    try { cache_t(name, 2000, 0.5, std::hash<int>(), 4); } catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown);
+    //same sizes, other types
+    thrown = false;
+    try { shared_ttl_cache<int, float>(name, 1000, 0.5, std::hash<int>(), 4); } catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown);
+  }
+  assert(cache_t::remove(name));
+}
+
+/* the background reaper of realtime_ttl_cache removes the expired entries of a thread-safe cache
+   without any removeExpired call from the user, and leaves the others
+   compile with -pthread
+*/
+void reaperTest() {
+  //twice as large as needed, so that no shard becomes full and evicts entries
+  int numEntries = 10000;
+  realtime_ttl_cache<int, int, std::hash<int>, 1000, sharded_ttl_cache<int, int>> cache(2*numEntries, 0.5, std::hash<int>());
+  int numLongLived = 500;
+  for (int i = 0; i < numLongLived; i++) cache.insert(i, i, 3600000);
+  for (int i = numLongLived; i < numEntries; i++) cache.insert(i, i, 20);
+
+  cache.startReaper(std::chrono::milliseconds(5), 0.25);
+  assert(cache.reaperRunning());
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  cache.stopReaper();
+  assert(not cache.reaperRunning());
+
+  //the expire algorithm stops below a load factor of 0.1 in each shard
+  std::cout<<"reaper: "<<cache.size()<<" entries left out of "<<numEntries<<std::endl;
+  assert(cache.size() <= 0.1 * cache.capacity() + 16*20);
+  for (int i = 0; i < numLongLived; i++) assert(cache.get(i) == i);
+
+  cache.startReaper(std::chrono::milliseconds(1), 0.25); //stopped by the destructor
+}
+
 int main() {
   // LRU_manualTest();
   // TTL_testcase();
   // automatedCorrectnessTest();
+  // removeExpiredBudgetTest();
+  // batchedOperationsTest();
+  // shardedCacheTest();
+  // concurrentCacheTest();
+  // getOrLoadTests();
+  // sharedCacheTest();
+  // reaperTest();
+  // clockPoliciesTest();
+  // inlineStorageTest();
+  // pow2CapacityTest();
+  // robinHoodTest();
+  // lazyGetTests();
+  // timerWheelTest();
+  // ttlJitterTest();
+  // statsTest<stats_options>();
+  // statsTest<stats_robin_hood_options>();
+  // clockEvictionTest();
+  // tinyLfuTest();
+  // transparentLookupTest();
+  // moveAwareInsertTest();
+  // weightedCacheTest();
+  // resizeTest<ttl_cache_options>();
+  // resizeTest<growable_options>();
+  // resizeTest<growable_inline_robin_hood_options>();
+  // controlBytesTest();
+  // compactEntriesTest();
+  // probeMonitorTest();
+  // snapshotsTest();
+  // bulkLoadTests();
+  // traceReplayTest();
+  // removalListenerTests();
+  // tieredCacheTest();
   realTimeCacheTest();
 }
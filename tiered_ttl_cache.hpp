@@ -0,0 +1,124 @@
+#ifndef TIERED_TTL_CACHE_H
+#define TIERED_TTL_CACHE_H
+
+#include "ttl_cache.hpp"
+#include <string> //the second tier stores the encoded values as bytes
+#include <optional>
+#include <utility>
+
+/* codec of the values of the second tier of tiered_ttl_cache: 'encode' turns a value into the bytes that
+   the second tier keeps, and 'decode' restores it. the default one uses the serializers of the snapshots
+   (see ttl_cache_serializer), so the second tier only keeps the bytes of the values.
+   a codec that also compresses them (e.g., with LZ4 or zstd) can be used instead, with the same interface
+*/
+template<class Value, class Serializer = ttl_cache_serializer<Value>>
+struct ttl_cache_serializing_codec {
+  Serializer serializer;
+  std::string encode(const Value& value) const {
+    std::string bytes(serializer.size(value), '\0');
+    serializer.write(value, bytes.data());
+    return bytes;
+  }
+  Value decode(const std::string& bytes) const { return serializer.read(bytes.data(), bytes.size()); }
+};
+
+
+/* two-level cache: a ttl_cache of live values ("first tier") in front of a larger ttl_cache of encoded
+   values ("second tier"). the pairs that the first tier evicts while they are still alive are not lost:
+   its REMOVAL_LISTENER encodes them into the second tier, with the same expire time. a get that misses
+   the first tier looks in the second, and on a hit, the pair is decoded and promoted back to the first
+   tier (possibly demoting another pair). so a request for a recently evicted pair only costs a decoding,
+   instead of a request to the backend, and with a compressing codec, the second tier holds many more
+   pairs per byte than the first.
+
+   a key is in at most one tier: insert removes any older copy from the second tier.
+   expired pairs are not demoted. the second tier evicts its own LRU pairs when it is full.
+   Options are those of the first tier (its REMOVAL_LISTENER is replaced), and SecondTierOptions those of
+   the second tier. the time stamps follow the rules of ttl_cache, for both tiers.
+   the cache refers to itself from the listener, so it cannot be copied or moved
+*/
+template<class Key, class Value, class HashFunction = std::hash<Key>, class timestamp_t = long long int,
+         class Options = ttl_cache_options, class SecondTierOptions = ttl_cache_options,
+         class Codec = ttl_cache_serializing_codec<Value>>
+class tiered_ttl_cache {
+
+  //the listener of the first tier, which demotes the evicted pairs
+  struct Demoter {
+    tiered_ttl_cache* owner = nullptr;
+    void operator()(const Key& key, Value& value, timestamp_t expireTime, ttl_cache_removal_cause cause) {
+      if (cause == ttl_cache_removal_cause::evicted) owner->demote(key, value, expireTime);
+    }
+  };
+  struct FirstTierOptions : Options { typedef Demoter REMOVAL_LISTENER; };
+
+  ttl_cache<Key, Value, HashFunction, timestamp_t, FirstTierOptions> first;
+  ttl_cache<Key, std::string, HashFunction, timestamp_t, SecondTierOptions> second;
+  Codec codec;
+  timestamp_t currentTime; //of the operation in progress, for the ttls of the demoted pairs
+  std::size_t _promotions, _demotions;
+
+public:
+
+  tiered_ttl_cache(std::size_t firstTierEntries, std::size_t secondTierEntries, double maxLoadFactor,
+                   const HashFunction& hashFunction, const Codec& codec = Codec()):
+    first(firstTierEntries, maxLoadFactor, hashFunction),
+    second(secondTierEntries, maxLoadFactor, hashFunction),
+    codec{codec},
+    currentTime{0},
+    _promotions{0}, _demotions{0}
+  {
+    first.removalListener().owner = this;
+  }
+
+  tiered_ttl_cache(const tiered_ttl_cache&) = delete;
+  tiered_ttl_cache& operator=(const tiered_ttl_cache&) = delete;
+
+  std::optional<Value> get(const Key& key, timestamp_t timeStamp) {
+    currentTime = timeStamp;
+    std::optional<Value> res = first.get(key, timeStamp);
+    if (res) return res;
+
+    std::optional<std::string> bytes = second.get(key, timeStamp);
+    if (not bytes) return {};
+    timestamp_t ttl = *second.remaining_ttl(key, timeStamp);
+    second.erase(key, timeStamp);
+    res = codec.decode(*bytes);
+    first.insert(key, *res, timeStamp, ttl);
+    _promotions++;
+    return res;
+  }
+
+  void insert(const Key& key, const Value& value, timestamp_t timeStamp, timestamp_t ttl) {
+    currentTime = timeStamp;
+    first.insert(key, value, timeStamp, ttl);
+    second.erase(key, timeStamp);
+  }
+
+  //runs the expire algorithm on both tiers, and returns the expired ratio of the first one
+  double removeExpired(timestamp_t timeStamp, double targetRatio) {
+    currentTime = timeStamp;
+    second.removeExpired(timeStamp, targetRatio);
+    return first.removeExpired(timeStamp, targetRatio);
+  }
+
+  std::size_t size() const { return first.size() + second.size(); }
+  bool empty() const { return size() == 0; }
+  std::size_t firstTierSize() const { return first.size(); }
+  std::size_t secondTierSize() const { return second.size(); }
+  timestamp_t currentTimeStamp() const { return currentTime; }
+
+  //pairs moved from the second tier to the first one by a get, and from the first tier to the second one
+  std::size_t promotions() const { return _promotions; }
+  std::size_t demotions() const { return _demotions; }
+
+private:
+
+  void demote(const Key& key, const Value& value, const timestamp_t expireTime) {
+    if (expireTime <= currentTime) return;
+    second.insert(key, codec.encode(value), currentTime, expireTime - currentTime);
+    _demotions++;
+  }
+
+};
+
+#endif /* TIERED_TTL_CACHE_H */
@@ -8,7 +8,27 @@
 #include <cmath> //ceil
 #include <random> //to get random samples in the expire algorithm
 #include <chrono> //random seed for expire algo, default timestamp type
-#include <vector> //to store the samples in the expire algorithm
+#include <vector> //LRU order, slabs of the node pool
+#include <algorithm> //min, max
+#include <limits> //default work bound of the expire algorithm
+#include <type_traits> //conditional, to choose the storage layout
+#include <cstdint> //32-bit LRU links with inline storage
+#include <new> //placement new for the node pool
+#include <utility> //forward, piecewise_construct
+#include <cstring> //memset of the control bytes
+#include <string> //snapshot file paths
+#include <fstream> //writing snapshots
+#include <thread> //hashing the keys of bulk loads
+#include <iterator> //advance
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h> //16 control bytes compared at once
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h> //snapshots are loaded from a memory-mapped file
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 /* In-memory hash table that acts as a cache for a Key-Value storage and supports timeouts.
@@ -30,7 +50,534 @@ Expired entries which are still in the table are removed in two ways:
   2. Actively, by calling 'removeExpired'. This can prevent the LRU mechanism from removing still-alive enties.
 */
 
-template<class Key, class Value, class HashFunction = std::hash<Key>, class timestamp_t = long long int>
+
+/* why a pair left the cache, for the REMOVAL_LISTENER option.
+   'evicted' pairs were still alive: they were removed to make room (or by the weight budget, or resize)
+*/
+enum class ttl_cache_removal_cause { expired, evicted, erased };
+
+
+/* compile-time options of ttl_cache, passed as its last template argument.
+   to change an option, inherit from this struct and redefine it. e.g.:
+
+   struct inline_options : ttl_cache_options { static constexpr bool INLINE_STORAGE = true; };
+   ttl_cache<int, int, std::hash<int>, long long, inline_options> cache(maxEntries, loadFactor, std::hash<int>());
+*/
+struct ttl_cache_options {
+
+  /* storage policy. by default, each key-value pair is allocated in its own node and the table
+     only holds a pointer to it (see TableEntry).
+     with inline storage, the key-value pairs are stored directly in the table and the LRU list links
+     are 32-bit table indices, so there is no allocation per entry and no pointer to follow on a hit.
+     it requires trivially-copyable keys and values, since entries are copied when they are relocated.
+     the key's hash is not stored: it is recomputed when needed, so the hash function should be cheap
+     it is intended for small types, e.g. for ttl_cache<int,int> it uses 3 words per table cell in total
+  */
+  static constexpr bool INLINE_STORAGE = false;
+
+  /* table size policy. by default, the capacity is ceil(maxEntries/maxLoadFactor), and positions
+     in the table are computed with modulo operations (an integer division at every probing step).
+     with POW2_CAPACITY, the capacity is rounded up to a power of two and positions are computed
+     with a bit mask. since a mask only keeps the low bits of the hash, the hashes are also passed
+     through a finalizer that mixes all their bits, so that weak hash functions (e.g., the identity
+     std::hash<int> of libstdc++) still spread the keys across the table.
+     the maximum number of cached pairs is still maxEntries, so the actual load factor is lower
+  */
+  static constexpr bool POW2_CAPACITY = false;
+
+  /* hash post-mixing. without POW2_CAPACITY, the table index is hash % capacity, so with a weak hash
+     function (e.g., the identity std::hash<int> of libstdc++) and sequential keys, the keys fall into runs
+     of consecutive entries, which merge into long clusters. with HASH_MIXER, the hashes also go through
+     the finalizer of POW2_CAPACITY. both mix in a seed of the cache, which 'reseed' changes (rebuilding
+     the table) to move the keys to other positions. it does not help with keys whose hashes are equal
+  */
+  static constexpr bool HASH_MIXER = false;
+
+  /* probing engine. by default, the table uses plain linear probing: get/insert remove the expired
+     entries of the whole cluster of the key (see fixCluster) and then relocate the remaining ones.
+     with ROBIN_HOOD, the entries of each cluster are kept sorted by ideal position ("Robin Hood"
+     linear probing), which has two consequences:
+     - a search can stop as soon as it finds an entry closer to its ideal position than the key would be
+     - an entry can be removed by shifting the following entries back by one ("backward-shift deletion")
+     so get/insert only look at the entries on the key's probing path (removing the expired ones they find),
+     and the maximum load factor is raised from 0.5 to 0.9
+  */
+  static constexpr bool ROBIN_HOOD = false;
+
+  /* read path. by default, get removes the expired entries it can find (see "TTL" above), which
+     means going through the whole cluster of the key with linear probing.
+     with LAZY_GET, get only checks the expiration of the entries on the probing path of the key,
+     and leaves the expired ones in place as tombstones: searches skip over them, and they are
+     reclaimed by insert (which still fixes the cluster of its key), the LRU mechanism, and removeExpired.
+     the cost of get is then just the probe length, and get never removes or moves table entries, so the
+     clusters are left unchanged (with INLINE_STORAGE, a hit still writes the LRU links of its table entry)
+  */
+  static constexpr bool LAZY_GET = false;
+
+  /* active expiration. by default, expired entries are only found by 'removeExpired', which takes
+     random samples of the table. with TIMER_WHEEL, the entries are also registered in a hierarchical
+     timing wheel bucketed by expire time, so that 'removeExpiredUntil' can remove exactly the
+     expired entries, in time proportional to their number.
+     it costs two more LRU-sized links and a 16-bit bucket id per entry.
+     the wheel buckets have a width of TIMER_WHEEL_RESOLUTION time units (it must be at least 1 for
+     integer time stamps). entries that expire in the current bucket are checked individually
+  */
+  static constexpr bool TIMER_WHEEL = false;
+  static constexpr double TIMER_WHEEL_RESOLUTION = 1;
+
+  /* ttl jitter. pairs inserted in a batch with the same ttl all expire at the same time, and are then
+     removed (and reloaded by the user) in the same burst. with TTL_JITTER > 0, insert shortens each ttl
+     by a random fraction of it, up to TTL_JITTER (e.g., 0.1 for up to 10%), so their expirations
+     are spread over that interval. the fraction is taken from the cache's RNG, or, with HASHED_JITTER,
+     from the hash given by the hash function (not the seeded hash of HASH_MIXER, which changes with
+     reseeds), so that a key always gets the same fraction, also in another process or cache, as long as
+     the hash function gives the same hashes there. HASHED_JITTER costs one more call to the hash function.
+     TTL_JITTER must be in [0, 1]. the ttls of pairs loaded from a snapshot are not jittered again
+  */
+  static constexpr double TTL_JITTER = 0;
+  static constexpr bool HASHED_JITTER = false;
+
+  /* runtime statistics. with STATS, the cache counts what happens in its operations (hits, misses,
+     expirations, evictions, relocations, probe lengths, rounds of the expire algorithm), and 'stats()'
+     returns a snapshot of the counters (see ttl_cache_stats). like VERBOSE, it is a compile-time
+     constant, so the counting code is removed entirely when it is false
+  */
+  static constexpr bool STATS = false;
+
+  /* eviction policy. by default, the cached pairs form a doubly-linked list in LRU order, and every
+     hit moves its pair to the end of the list, which writes to the pair and its neighbours.
+     with CLOCK_EVICTION, the list is replaced by the CLOCK approximation of LRU: each table entry has
+     a reference bit (in a separate byte array) that get/insert set, and a "hand" sweeps the table
+     positions to find the entry to evict, clearing the reference bits it finds set (so an entry is
+     only evicted if it was not used since the hand last went past it). expired entries are taken first.
+     a hit then only writes one byte, and the pairs do not have the two LRU links.
+     LRU_order() is not available with this policy
+  */
+  static constexpr bool CLOCK_EVICTION = false;
+
+  /* admission policy. by default, insert always admits the new pair, evicting the least recently used
+     one if the cache is full, so a scan of keys that are never read again flushes the whole cache.
+     with TINY_LFU, the cache follows W-TinyLFU: new pairs enter a small LRU "window" (1% of the cache),
+     and the pairs leaving the window only enter the main LRU list if their estimated access frequency
+     is higher than that of the main list's least recently used pair (which is then evicted).
+     otherwise, the pair leaving the window is evicted instead. the frequencies of all the accessed keys
+     (cached or not) are estimated by a count-min sketch that is periodically aged.
+     it costs about 8 bytes per entry for the sketch. it requires the LRU eviction policy (not CLOCK_EVICTION)
+  */
+  static constexpr bool TINY_LFU = false;
+
+  /* memory bound. by default, the cache only bounds the number of pairs (maxEntries).
+     if WEIGHER is a function object type, with a 'std::size_t operator()(const Key&, const Value&) const'
+     that returns the "weight" of a pair (e.g., its size in bytes), the cache takes a 'maxWeight' at
+     construction, and insert evicts pairs (following the eviction policy) until the total weight of the
+     cached pairs is at most maxWeight. maxEntries still bounds the number of pairs and sizes the table,
+     so it can be set from the smallest expected weight. the weight of a pair is computed when it is
+     inserted or updated, and stored in it (one more word per pair).
+     a pair that is heavier than maxWeight on its own is not cached
+  */
+  typedef void WEIGHER;
+
+  /* removal notifications. if REMOVAL_LISTENER is a function object type, with a
+     'void operator()(const Key&, Value&, timestamp_t expireTime, ttl_cache_removal_cause)', the cache calls it
+     for every pair that it removes, with the reason: expired (found by any mechanism: get/insert,
+     removeExpired, removeExpiredUntil, or the eviction policy), evicted while still alive, or erased.
+     it is called just before the pair is destroyed, so the listener can move the value out (e.g., to a
+     second tier, see tiered_ttl_cache). it is constructed by default, and 'removalListener()' gives access
+     to it. it must not call the cache. pairs replaced by an insertion, or destroyed with the cache,
+     are not notified
+  */
+  typedef void REMOVAL_LISTENER;
+
+  /* table growth. by default, the table (and the node pool) are allocated at construction for maxEntries
+     pairs, and never change unless 'resize' is called. with GROWABLE_TABLE, they start sized for a few
+     pairs and are rebuilt with twice the size whenever they are full, up to the size for maxEntries,
+     so caches that stay small do not use the memory for their maximum size.
+     a rebuild reinserts all the pairs into the new table (keeping their LRU order and expire times),
+     so the insertion that triggers it takes time proportional to the number of pairs, with every layout
+     (the rebuilds are not incremental). this is constant time on average, but not in the worst case
+  */
+  static constexpr bool GROWABLE_TABLE = false;
+
+  /* probing metadata. by default, every probing step loads a whole table entry (e.g., 3 words) to compare
+     its hash (or, with inline storage, its key). with CONTROL_BYTES, the table also has a separate array
+     with one "control byte" per entry ("Swiss table" style): 7 bits of the entry's hash, or a flag for
+     empty entries. searches compare the control bytes of 16 consecutive entries at once (with SSE2,
+     or a plain loop otherwise), and only load the entries whose 7 bits match, so misses and long clusters
+     touch much less memory. emptiness checks (e.g., when fixing a cluster) also read the control bytes.
+     it costs one byte per table entry. with ROBIN_HOOD, the searches still use its early termination
+  */
+  static constexpr bool CONTROL_BYTES = false;
+
+  /* table entry layout. by default, each table entry stores the full expire time (a timestamp_t) and,
+     without inline storage, the full std::size_t hash (3 words per entry in total).
+     with COMPACT_ENTRIES, both are 32 bits (2 words per entry): hashes are folded to 32 bits, and expire
+     times are stored as a number of ticks of COMPACT_RESOLUTION time units after an "epoch" of the cache,
+     which moves forward (rewriting all the entries) when the current time gets too far from it.
+     expire times are rounded up to a whole tick, and capped to MAX_EXPIRE_OFFSET (2^32-2) ticks past the
+     epoch. since the epoch can lag the current tick by up to 2^31 ticks, ttls longer than 2^31 ticks may
+     be shortened, and ttls longer than 2^32 ticks always are.
+     COMPACT_RESOLUTION must be at least 1 for integer time stamps
+  */
+  static constexpr bool COMPACT_ENTRIES = false;
+  static constexpr double COMPACT_RESOLUTION = 1;
+
+  /* placement of the table. by default, the table and its metadata arrays are allocated on the heap.
+     with RELATIVE_POINTERS, the cache is constructed with a region of memory for them (see
+     relativeArraysSize), and refers to them by their offset from the cache object instead of by address.
+     then a cache placed in memory shared between processes works wherever each process maps it
+     (see shared_ttl_cache). everything must stay in that memory: it requires inline storage (there are
+     no nodes), and it does not support GROWABLE_TABLE, resize, or TINY_LFU (whose sketch is allocated)
+  */
+  static constexpr bool RELATIVE_POINTERS = false;
+
+  /* probe length monitor. with PROBE_MONITOR, the cache measures the probe lengths of the searches of
+     get/insert (the displacement of the key plus one, as in the STATS histogram) over windows of 1024
+     searches, and raises an alarm when the average of a window is above PROBE_ALARM_AVERAGE or its maximum
+     is above PROBE_ALARM_MAX (see probeReport). with REBUILD_ON_ALARM, an alarm also makes the next
+     insertion call reseed, which requires HASH_MIXER (or POW2_CAPACITY). there is at most one such rebuild
+     per 'size()' searches, so their cost stays constant on average even if the alarms persist
+  */
+  static constexpr bool PROBE_MONITOR = false;
+  static constexpr double PROBE_ALARM_AVERAGE = 8;
+  static constexpr std::size_t PROBE_ALARM_MAX = 256;
+  static constexpr bool REBUILD_ON_ALARM = false;
+};
+
+
+/* snapshot of the statistics of a ttl_cache (requires the STATS option).
+   the histograms have logarithmic buckets: bucket i counts the lengths in [2^i, 2^(i+1)),
+   and the last bucket also counts all the longer ones
+*/
+struct ttl_cache_stats {
+  static constexpr unsigned int HISTOGRAM_BUCKETS = 16;
+
+  //get calls (including the keys of get_many)
+  std::size_t gets = 0;
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+
+  //insert calls (including the pairs of insert_many), split by whether the key was already cached
+  std::size_t inserts = 0;
+  std::size_t updates = 0;
+
+  //removed entries: expired (found by any mechanism), and evicted by the LRU mechanism
+  std::size_t expirations = 0;
+  std::size_t evictions = 0;
+
+  //entries moved to a different position of the table to keep the open addressing invariant
+  std::size_t relocations = 0;
+
+  /* table entries examined by the searches of get/insert, from the ideal position of the key to the key
+     (or, on a miss, to where the search stopped, both included). a hash function that distributes
+     the keys badly shows up as a heavy tail in the histogram */
+  std::size_t probeSteps = 0;
+  std::size_t probeLengthHistogram[HISTOGRAM_BUCKETS] = {};
+
+  //the active expiration: removeExpired calls, their sampling rounds, and the entries sampled and removed
+  std::size_t expireCalls = 0;
+  std::size_t expireRounds = 0;
+  std::size_t expireSampled = 0;
+  std::size_t expireRemoved = 0; //also includes the entries removed by removeExpiredUntil
+  double lastExpiredRatio = 0; //of the last round
+
+  //pairs leaving the TINY_LFU window that were evicted because they were not more frequent than the LRU pair
+  std::size_t admissionRejections = 0;
+
+  //lengths of the current clusters of the table, computed when the snapshot is taken
+  std::size_t clusterLengthHistogram[HISTOGRAM_BUCKETS] = {};
+
+  double hitRatio() const { return gets == 0 ? 0 : hits/(double) gets; }
+  double averageProbeLength() const { return gets + inserts + updates == 0 ? 0 : probeSteps/(double) (gets + inserts + updates); }
+
+  static unsigned int histogramBucket(std::size_t length) {
+    unsigned int bucket = 0;
+    while (length > 1 and bucket < HISTOGRAM_BUCKETS-1) {
+      length /= 2;
+      bucket++;
+    }
+    return bucket;
+  }
+};
+
+
+/* report of the probe length monitor of a ttl_cache (requires the PROBE_MONITOR option) */
+struct ttl_cache_probe_report {
+  //probe lengths of the searches of the last complete window
+  double averageProbeLength = 0;
+  std::size_t maxProbeLength = 0;
+
+  //windows above a threshold, and rebuilds of the table with a new hash seed (by reseed or REBUILD_ON_ALARM)
+  std::size_t alarms = 0;
+  std::size_t reseeds = 0;
+};
+
+
+/* pool of objects of type T, preallocated in large contiguous slabs.
+   the free slots form a singly-linked list threaded through the slabs themselves,
+   so creating and destroying objects never calls the global allocator and
+   recently freed (and likely still cached) slots are reused first.
+   the pool does not keep track of live objects: they must be destroyed by the owner
+*/
+template<class T>
+class node_pool {
+
+  union Slot {
+    Slot* nextFree;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  std::vector<Slot*> slabs;
+  Slot* freeList;
+  std::size_t _capacity;
+
+public:
+
+  node_pool(): freeList{nullptr}, _capacity{0} {}
+  node_pool(const node_pool&) = delete;
+  node_pool& operator=(const node_pool&) = delete;
+
+  ~node_pool() {
+    for (Slot* slab : slabs) delete[] slab;
+  }
+
+  //grows the pool, with a single new slab, so that it can hold 'capacity' objects
+  void reserve(const std::size_t capacity) {
+    if (capacity <= _capacity) return;
+    std::size_t slabSize = capacity - _capacity;
+    Slot* slab = new Slot[slabSize];
+    slabs.push_back(slab);
+    //threaded in reverse so that consecutive allocations get consecutive addresses
+    for (std::size_t i = slabSize; i > 0; i--) {
+      slab[i-1].nextFree = freeList;
+      freeList = &slab[i-1];
+    }
+    _capacity = capacity;
+  }
+
+  template<class... Args>
+  T* create(Args&&... args) {
+    assert(freeList != nullptr);
+    Slot* slot = freeList;
+    freeList = slot->nextFree;
+    return new (slot->storage) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(T* obj) {
+    obj->~T();
+    Slot* slot = reinterpret_cast<Slot*>(obj);
+    slot->nextFree = freeList;
+    freeList = slot;
+  }
+
+  std::size_t capacity() const { return _capacity; }
+  bool full() const { return freeList == nullptr; }
+};
+
+
+/* count-min sketch that estimates how many times each hash was recorded, in small memory
+   (used by the TINY_LFU option). it has 4 rows of 4-bit saturating counters (up to 15), packed 16 per
+   word; a hash increments one counter per row, and its estimate is the minimum of them (collisions
+   can only overestimate). each row has 4 counters per key that should be told apart, so the sketch
+   takes 8 bytes per key. to keep up with changes in popularity, all the counters are halved every
+   'sampleSize' recordings
+*/
+class frequency_sketch {
+
+  static constexpr unsigned int DEPTH = 4;
+  static constexpr unsigned int COUNTERS_PER_KEY = 4;
+  static constexpr uint64_t MAX_COUNT = 15;
+
+  std::vector<uint64_t> words; //DEPTH rows of 'width' counters
+  std::size_t width; //a power of two, at least 16
+  std::size_t recordings, sampleSize;
+
+public:
+
+  frequency_sketch(): width{0}, recordings{0}, sampleSize{0} {}
+
+  void init(const std::size_t numKeys) {
+    width = 16;
+    while (width < COUNTERS_PER_KEY * numKeys) width *= 2;
+    words.assign(DEPTH * width / 16, 0);
+    sampleSize = 10 * numKeys;
+    recordings = 0;
+  }
+
+  void record(const std::size_t hash) {
+    bool incremented = false;
+    for (unsigned int row = 0; row < DEPTH; row++) {
+      std::size_t counter = row*width + column(hash, row);
+      uint64_t& word = words[counter / 16];
+      unsigned int shift = (counter % 16) * 4;
+      if (((word >> shift) & MAX_COUNT) < MAX_COUNT) {
+        word += uint64_t(1) << shift;
+        incremented = true;
+      }
+    }
+    if (incremented and ++recordings >= sampleSize) age();
+  }
+
+  unsigned int estimate(const std::size_t hash) const {
+    uint64_t res = MAX_COUNT;
+    for (unsigned int row = 0; row < DEPTH; row++) {
+      std::size_t counter = row*width + column(hash, row);
+      res = std::min(res, (words[counter / 16] >> ((counter % 16) * 4)) & MAX_COUNT);
+    }
+    return (unsigned int) res;
+  }
+
+private:
+
+  //double hashing over a mixed hash, so that the rows are independent even for weak hash functions
+  inline std::size_t column(const std::size_t hash, const unsigned int row) const {
+    uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 32;
+    uint64_t step = (h >> 17) | 1;
+    return (std::size_t) ((h + row * step) & (width - 1));
+  }
+
+  //halves all the counters at once: shifting a word halves each counter, and the mask clears the bits
+  //that the shift moved from a counter into the one below it
+  void age() {
+    for (uint64_t& word : words) word = (word >> 1) & 0x7777777777777777ull;
+    recordings /= 2;
+  }
+};
+
+
+/* whether a cache type can be used from several threads at the same time. it is specialized by the
+   thread-safe variants (sharded_ttl_cache, concurrent_ttl_cache). realtime_ttl_cache requires it for
+   its background reaper, which runs the expire algorithm concurrently with the user's calls
+*/
+template<class Cache> struct is_thread_safe_cache : std::false_type {};
+
+
+//end-of-list marker for the links of the LRU list: nullptr for pointers, all-ones for indices
+template<class T> struct ttl_cache_nil { static constexpr T value = T(~T(0)); };
+template<class T> struct ttl_cache_nil<T*> { static constexpr T* value = nullptr; };
+
+
+/* pointer stored as the offset from its own address to its target (as the offset_ptr of
+   Boost.Interprocess), used for the arrays of the cache with RELATIVE_POINTERS. it stays valid if the
+   memory holding both the pointer and its target is mapped at another address, but not if the pointer
+   alone is copied, so it cannot be copied. offset 0 is the null pointer
+*/
+template<class T>
+class ttl_cache_offset_ptr {
+
+  std::ptrdiff_t offset;
+
+public:
+
+  ttl_cache_offset_ptr(T* ptr = nullptr) { *this = ptr; }
+  ttl_cache_offset_ptr(const ttl_cache_offset_ptr&) = delete;
+  ttl_cache_offset_ptr& operator=(const ttl_cache_offset_ptr&) = delete;
+
+  ttl_cache_offset_ptr& operator=(T* ptr) {
+    offset = ptr ? reinterpret_cast<const char*>(ptr) - reinterpret_cast<const char*>(this) : 0;
+    return *this;
+  }
+
+  inline T* get() const {
+    if (offset == 0) return nullptr;
+    return reinterpret_cast<T*>(const_cast<char*>(reinterpret_cast<const char*>(this)) + offset);
+  }
+  inline operator T*() const { return get(); }
+  inline T& operator[](const std::size_t index) const { return get()[index]; }
+};
+
+
+/* whether a hash function is "transparent", with the same convention as the heterogeneous lookup of
+   C++20 unordered_map: it declares a member type 'is_transparent', and it accepts other key-like types
+   (e.g., std::string_view for std::string keys), giving them the same hash as the equivalent key.
+   then get, insert and peek also take these types, which must be comparable with the keys using ==
+*/
+template<class HashFunction, class = void> struct ttl_cache_is_transparent : std::false_type {};
+template<class HashFunction>
+struct ttl_cache_is_transparent<HashFunction, std::void_t<typename HashFunction::is_transparent>> : std::true_type {};
+
+
+/* serialization of the keys and values in snapshots (see ttl_cache::save). this default one copies the
+   bytes of trivially-copyable types. for other types, specialize it, or pass another serializer with the
+   same interface to save and load. e.g., for std::string:
+
+   template<> struct ttl_cache_serializer<std::string> {
+     std::size_t size(const std::string& s) const { return s.size(); }
+     void write(const std::string& s, char* out) const { std::memcpy(out, s.data(), s.size()); }
+     std::string read(const char* in, std::size_t size) const { return std::string(in, size); }
+   };
+
+   'write' gets a buffer of 'size(value)' bytes, and 'read' gets the same bytes back (not aligned)
+*/
+template<class T>
+struct ttl_cache_serializer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "the default snapshot serializer requires trivially-copyable types");
+  std::size_t size(const T&) const { return sizeof(T); }
+  void write(const T& value, char* out) const { std::memcpy(out, &value, sizeof(T)); }
+  T read(const char* in, std::size_t size) const {
+    if (size != sizeof(T)) throw std::runtime_error("snapshot of a different type");
+    T value;
+    std::memcpy(&value, in, sizeof(T));
+    return value;
+  }
+};
+
+
+/* read-only view of a whole file: memory-mapped where mmap is available, or read into memory otherwise.
+   used to load snapshots, which are read once sequentially
+*/
+class ttl_cache_mapped_file {
+
+  const char* _data;
+  std::size_t _size;
+  std::vector<char> buffer; //without mmap
+
+public:
+
+  explicit ttl_cache_mapped_file(const std::string& path): _data{nullptr}, _size{0} {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open snapshot file " + path);
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw std::runtime_error("cannot open snapshot file " + path);
+    }
+    _size = info.st_size;
+    if (_size > 0) {
+      void* address = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (address == MAP_FAILED) throw std::runtime_error("cannot map snapshot file " + path);
+      ::madvise(address, _size, MADV_SEQUENTIAL);
+      _data = static_cast<const char*>(address);
+    } else {
+      ::close(fd);
+    }
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (not file) throw std::runtime_error("cannot open snapshot file " + path);
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    _data = buffer.data();
+    _size = buffer.size();
+#endif
+  }
+  ttl_cache_mapped_file(const ttl_cache_mapped_file&) = delete;
+  ttl_cache_mapped_file& operator=(const ttl_cache_mapped_file&) = delete;
+
+  ~ttl_cache_mapped_file() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (_data) ::munmap(const_cast<char*>(_data), _size);
+#endif
+  }
+
+  const char* data() const { return _data; }
+  std::size_t size() const { return _size; }
+};
+
+
+template<class Key, class Value, class HashFunction = std::hash<Key>, class timestamp_t = long long int,
+         class Options = ttl_cache_options>
 class ttl_cache {
 
 private:
@@ -39,17 +586,90 @@ private:
   //can remove all the dead logging code when it is set to false
   static constexpr bool VERBOSE = false;
 
+  static constexpr bool INLINE = Options::INLINE_STORAGE;
+  static constexpr bool POW2 = Options::POW2_CAPACITY;
+  static constexpr bool MIXED = POW2 or Options::HASH_MIXER;
+  static constexpr bool ROBIN_HOOD = Options::ROBIN_HOOD;
+  static constexpr bool LAZY_GET = Options::LAZY_GET;
+  static constexpr bool TIMER_WHEEL = Options::TIMER_WHEEL;
+  static constexpr double TTL_JITTER = Options::TTL_JITTER;
+  static constexpr bool HASHED_JITTER = Options::HASHED_JITTER;
+  static constexpr bool STATS = Options::STATS;
+  static constexpr bool CLOCK = Options::CLOCK_EVICTION;
+  static constexpr bool TINY_LFU = Options::TINY_LFU;
+  static constexpr bool TRANSPARENT = ttl_cache_is_transparent<HashFunction>::value;
+  typedef typename Options::WEIGHER Weigher;
+  static constexpr bool WEIGHTED = not std::is_void<Weigher>::value;
+  typedef typename Options::REMOVAL_LISTENER RemovalListener;
+  static constexpr bool NOTIFIED = not std::is_void<RemovalListener>::value;
+  static constexpr bool GROWABLE = Options::GROWABLE_TABLE;
+  static constexpr std::size_t INITIAL_TABLE_ENTRIES = 16; //with GROWABLE_TABLE
+  static constexpr bool CONTROL = Options::CONTROL_BYTES;
+  static constexpr bool COMPACT = Options::COMPACT_ENTRIES;
+  static constexpr bool RELATIVE = Options::RELATIVE_POINTERS;
+  static constexpr bool PROBE_MONITOR = Options::PROBE_MONITOR;
+  static constexpr bool REBUILD_ON_ALARM = Options::REBUILD_ON_ALARM;
+  static_assert(not RELATIVE or (Options::INLINE_STORAGE and not GROWABLE and not TINY_LFU),
+                "relative pointers require inline storage, and do not support GROWABLE_TABLE or TINY_LFU");
+  static_assert(not COMPACT or not std::is_integral<timestamp_t>::value or Options::COMPACT_RESOLUTION >= 1,
+                "the resolution of compact expire times must be at least 1 for integer time stamps");
+  static_assert(not (TINY_LFU and CLOCK), "TINY_LFU requires the LRU eviction policy");
+  static_assert(TTL_JITTER >= 0 and TTL_JITTER <= 1, "the ttl jitter must be a fraction of the ttl");
+  static_assert(not REBUILD_ON_ALARM or (PROBE_MONITOR and MIXED and not RELATIVE),
+                "REBUILD_ON_ALARM requires PROBE_MONITOR, a mixed hash, and a table that can be reallocated");
+  static constexpr double MAX_LOAD_FACTOR = ROBIN_HOOD ? 0.9 : 0.5;
+  static_assert(not INLINE or (std::is_trivially_copyable<Key>::value and std::is_trivially_copyable<Value>::value),
+                "inline storage requires trivially-copyable keys and values");
+
+  struct KeyValue;
+
+  /* reference to a node of the LRU list: a pointer to its KeyValue, or,
+     with inline storage, the index of the table entry holding it */
+  typedef typename std::conditional<INLINE, uint32_t, KeyValue*>::type node_t;
+  static constexpr node_t NIL = ttl_cache_nil<node_t>::value;
+
+  //with TIMER_WHEEL, each KeyValue is also in the doubly-linked list of a bucket of the timing wheel
+  struct WheelLinks {
+    node_t wheelNext, wheelPrev;
+    uint16_t wheelBucket;
+    WheelLinks(): wheelNext{NIL}, wheelPrev{NIL}, wheelBucket{0} {}
+  };
+  struct NoWheelLinks {};
+
+  //the links of the LRU list (not needed with CLOCK_EVICTION)
+  struct LRULinks {
+    node_t next, prev;
+    LRULinks(): next{NIL}, prev{NIL} {}
+  };
+  struct NoLRULinks {};
+  //with TINY_LFU, the pairs are either in the window list or in the main list
+  struct WindowedLRULinks : LRULinks {
+    bool inWindow;
+    WindowedLRULinks(): inWindow{false} {}
+  };
+  typedef typename std::conditional<TINY_LFU, WindowedLRULinks, LRULinks>::type ListLinks;
+
+  //with WEIGHER, the weight of each pair is stored, so that it can be subtracted when the pair is removed
+  struct PairWeight {
+    std::size_t weight;
+    PairWeight(): weight{0} {}
+  };
+  struct NoPairWeight {};
+
   /* each key-value pair is stored in this struct
-     it makes a doubly-linked list ('prev' and 'next' pointers) to be able to implement the LRU mechanism
+     it makes a doubly-linked list ('prev' and 'next' links) to be able to implement the LRU mechanism
   */
-  struct KeyValue {
+  struct KeyValue : std::conditional<CLOCK, NoLRULinks, ListLinks>::type,
+                    std::conditional<TIMER_WHEEL, WheelLinks, NoWheelLinks>::type,
+                    std::conditional<WEIGHTED, PairWeight, NoPairWeight>::type {
     Key key;
     Value value;
-    KeyValue *next, *prev;
-    KeyValue(Key key, Value value):
-      key{std::move(key)},
-      value{std::move(value)},
-      next{nullptr}, prev{nullptr} {}
+    KeyValue(): key{}, value{} {} //only used for empty cells with inline storage
+    //the key is constructed from the lookup key, and the value in place from 'valueArgs'
+    template<class LookupKey, class... ValueArgs>
+    KeyValue(std::piecewise_construct_t, LookupKey&& key, ValueArgs&&... valueArgs):
+      key(std::forward<LookupKey>(key)),
+      value(std::forward<ValueArgs>(valueArgs)...) {}
   };
 
   /* to determine which entries are expired.
@@ -65,74 +685,251 @@ private:
      smaller entries will also require fewer reads from memory to iterate through the
      table (since we use open addressing, sometimes we need to traverse it sequentially)
      thus, we do not want to put KeyValue structs directly in the table
-     instead, TableEntry is a small struct (3 words)
+     instead, TableEntry is a small struct (3 words, or 2 with COMPACT_ENTRIES)
      pointing to an actual KeyValue.
      It also keeps the key's hash and expire time so that we
      can check for a match without having to access the KeyValue
 
      invariant: the hash corresponds to the key's hash. if the KeyValue pointer
      is null, the hash/expireTime values are meaningless
+
+     with inline storage, the KeyValue is embedded in the entry instead, and the hash is not kept.
+     empty entries are marked with the EMPTY_FLAG expire time, and the KeyValue value is meaningless
   */
-  struct TableEntry {
+  //with COMPACT_ENTRIES, the stored hashes and expire times (see encodeExpireTime) are 32 bits
+  typedef typename std::conditional<COMPACT, uint32_t, std::size_t>::type hash_t;
+  typedef typename std::conditional<COMPACT, uint32_t, timestamp_t>::type expire_t;
+  static constexpr expire_t EMPTY_FLAG = COMPACT ? (expire_t) UINT32_MAX : (expire_t) -1;
+
+  struct NodeTableEntry {
     KeyValue *kv;
-    std::size_t hash;
-    timestamp_t expireTime;
-    TableEntry(): kv{nullptr}, hash{0}, expireTime{0} {}
+    hash_t hash;
+    expire_t expireTime;
+    NodeTableEntry(): kv{nullptr}, hash{0}, expireTime{0} {}
+  };
+
+  struct InlineTableEntry {
+    KeyValue kv;
+    expire_t expireTime;
+    InlineTableEntry(): kv{}, expireTime{EMPTY_FLAG} {}
   };
 
-  const HashFunction& hashFunction;
+  typedef typename std::conditional<INLINE, InlineTableEntry, NodeTableEntry>::type TableEntry;
+
+  //the arrays of the table: plain pointers, or offsets from the cache object with RELATIVE_POINTERS
+  template<class T>
+  using array_ptr = typename std::conditional<RELATIVE, ttl_cache_offset_ptr<T>, T*>::type;
+
+  const HashFunction hashFunction;
   double maxLoadFactor;
-  const std::size_t _capacity; //size of the hash table
+  std::size_t _capacity; //size of the hash table
+  std::size_t _maxSize; //LRU eviction threshold
+  std::size_t _tableMaxSize; //number of pairs the table is sized for (less than _maxSize only with GROWABLE_TABLE)
 
   /* the hash table using open addressing
      invariant (the "open addressing invariant"): there are no empty entries between a
      key's "ideal" position in the table and a key's actual position in the table
   */
-  TableEntry* table;
+  array_ptr<TableEntry> table;
+
+  /* the KeyValue nodes (unless they are stored inline). the number of cached pairs never exceeds
+     the number the table is sized for, so the pool is allocated in full for it, and only grows
+     when the table does */
+  node_pool<KeyValue> pool;
 
   /* LRU mechanism invariants:
    - if the cache is empty, both LRU_oldest and LRU_newest are NULL
    - if the cache contains 1 element, both LRU_oldest and LRU_newest point to it
    - with >1 elements, LRU_oldest and LRU_newest are the endpoints of the doubly-linked list
      with all the cached KeyValue pairs */
-  KeyValue *LRU_oldest, *LRU_newest;
+  node_t LRU_oldest, LRU_newest;
   std::size_t _size;
-  static constexpr timestamp_t LRU_EVICTED_FLAG = -2;
+  static constexpr expire_t LRU_EVICTED_FLAG = COMPACT ? (expire_t) 0 : (expire_t) -2;
+
+  /* COMPACT_ENTRIES epoch: a stored expire time e > 0 stands for the end of tick expireEpoch+e-1.
+     the epoch is never after the current tick, so the evicted flag (0) always looks expired
+  */
+  long long expireEpoch;
+
+  /* CLOCK mechanism (only with CLOCK_EVICTION): the reference bit of each table entry, which moves
+     with the entry when it is relocated, and the position of the hand. the LRU list is not used */
+  array_ptr<uint8_t> referenced;
+  std::size_t clockHand;
+
+  /* CONTROL_BYTES metadata: the control byte of each table entry, followed by copies of the first
+     CONTROL_GROUP-1 ones (repeated if the table is smaller), so that a group of CONTROL_GROUP bytes
+     starting at any index can be loaded without wrapping around
+  */
+  static constexpr unsigned int CONTROL_GROUP = 16;
+  static constexpr uint8_t EMPTY_CONTROL = 0x80; //the control bytes of the entries are 7-bit values
+  array_ptr<uint8_t> control;
 
   //for expire algorithm
   std::mt19937_64 RNG;
 
+  //mixed into the hashes with HASH_MIXER (or POW2_CAPACITY), and changed by reseed
+  std::size_t hashSeed;
+
+  /* scratch space of the expire algorithm: the (start, length) ranges of the clusters sampled in the
+     current round. fixing a cluster only moves entries backwards within its range, so a random index
+     in one of these ranges belongs to a cluster that was already sampled (and fixed).
+     every sampled cluster has at least one entry, so there are at most MIN_SAMPLE_SIZE per round
+  */
+  static constexpr unsigned int MIN_SAMPLE_SIZE = 20;
+  std::pair<std::size_t, std::size_t> sampledClusters[MIN_SAMPLE_SIZE];
+
+  /* hierarchical timing wheel (only with TIMER_WHEEL), in "ticks" of TIMER_WHEEL_RESOLUTION time units.
+     level L has 64 buckets, each covering 64^L ticks. an entry expiring at tick t is at the lowest
+     level L such that t and the wheel's time only differ in their (base-64) digits up to L, in the
+     bucket given by the L-th digit of t. when the wheel's time reaches the start of a bucket of level
+     L > 0, its entries are "cascaded" (redistributed) to lower levels. 11 levels cover all 63-bit ticks.
+     invariant: all the entries expiring before the wheel's time have been removed
+  */
+  static constexpr unsigned int WHEEL_BITS = 6;
+  static constexpr unsigned int WHEEL_SLOTS = 1 << WHEEL_BITS;
+  static constexpr unsigned int WHEEL_LEVELS = 11;
+  static constexpr unsigned int WHEEL_SCRATCH_BUCKET = WHEEL_LEVELS * WHEEL_SLOTS; //for entries set aside
+
+  struct TimerWheel {
+    node_t heads[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+    uint64_t occupied[WHEEL_LEVELS]; //bitmap of the non-empty buckets of each level
+    long long time;
+    TimerWheel(): occupied{}, time{0} { for (node_t& head : heads) head = NIL; }
+  };
+  struct NoTimerWheel {};
+  typename std::conditional<TIMER_WHEEL, TimerWheel, NoTimerWheel>::type wheel;
+
+  /* admission filter (only with TINY_LFU): the frequency sketch, and the window list, which has the same
+     invariants as the main list (LRU_oldest/LRU_newest). the main list holds the other _size-windowSize pairs
+  */
+  struct AdmissionFilter {
+    frequency_sketch sketch;
+    node_t windowOldest, windowNewest;
+    std::size_t windowSize, windowMaxSize;
+    AdmissionFilter(): windowOldest{NIL}, windowNewest{NIL}, windowSize{0}, windowMaxSize{0} {}
+  };
+  struct NoAdmissionFilter {};
+  typename std::conditional<TINY_LFU, AdmissionFilter, NoAdmissionFilter>::type admission;
+
+  //counters of the STATS option. the cluster length histogram is only filled in the snapshots
+  struct NoStats {};
+  typename std::conditional<STATS, ttl_cache_stats, NoStats>::type _stats;
+
+  /* probe length monitor (only with PROBE_MONITOR): the searches of the current window, the report,
+     and the searches since the last reseed, which bound the rebuilds of REBUILD_ON_ALARM
+  */
+  static constexpr std::size_t PROBE_WINDOW = 1024;
+  struct ProbeMonitor {
+    ttl_cache_probe_report report;
+    std::size_t windowSearches = 0, windowSteps = 0, windowMax = 0;
+    std::size_t searchesSinceReseed = 0;
+    bool reseedPending = false;
+  };
+  struct NoProbeMonitor {};
+  typename std::conditional<PROBE_MONITOR, ProbeMonitor, NoProbeMonitor>::type monitor;
+
+  //weight budget (only with WEIGHER): the total weight of the cached pairs never exceeds maxWeight
+  template<class W>
+  struct WeightBudget {
+    W weigher;
+    std::size_t totalWeight, maxWeight;
+    WeightBudget(): weigher{}, totalWeight{0}, maxWeight{0} {}
+  };
+  struct NoWeightBudget {};
+  typename std::conditional<WEIGHTED, WeightBudget<Weigher>, NoWeightBudget>::type weights;
+
+  /* removal listener (only with REMOVAL_LISTENER). the pair being evicted (or erased) has LRU_EVICTED_FLAG
+     as its expire time in the table, so its actual expire time and the cause are kept here
+  */
+  template<class L>
+  struct RemovalNotifier {
+    L listener;
+    timestamp_t evictedExpireTime;
+    ttl_cache_removal_cause evictionCause;
+    RemovalNotifier(): listener{}, evictedExpireTime{0}, evictionCause{ttl_cache_removal_cause::evicted} {}
+  };
+  struct NoRemovalNotifier {};
+  typename std::conditional<NOTIFIED, RemovalNotifier<RemovalListener>, NoRemovalNotifier>::type removals;
+
 
 public:
 
   ttl_cache(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction):
+    ttl_cache(maxEntries, maxLoadFactor, hashFunction, nullptr) {}
+
+  /* with RELATIVE_POINTERS: the arrays of the table are placed in the region at 'arrays', which must
+     have relativeArraysSize(maxEntries, maxLoadFactor) bytes (aligned for any type) and be part of the
+     same mapping as the cache object for as long as the cache is used
+  */
+  ttl_cache(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction, void* arrays):
     currentTime{0},
     hashFunction{hashFunction},
     maxLoadFactor{maxLoadFactor},
-    _capacity{maxLoadFactor >= 0.01 ? (std::size_t) ceil(maxEntries/maxLoadFactor) : 0},
+    _capacity{maxLoadFactor >= 0.01 ? tableCapacity(maxEntries, maxLoadFactor) : 0},
+    _maxSize{std::min(maxEntries, (std::size_t) (maxLoadFactor * _capacity))},
+    _tableMaxSize{_maxSize},
     table{nullptr},
-    LRU_oldest{nullptr}, LRU_newest{nullptr},
+    LRU_oldest{NIL}, LRU_newest{NIL},
     _size{0},
-    RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())}
+    expireEpoch{0},
+    referenced{nullptr},
+    clockHand{0},
+    control{nullptr},
+    RNG{static_cast<uint64_t> (std::chrono::steady_clock::now().time_since_epoch().count())},
+    hashSeed{0}
   {
-      if (maxLoadFactor > 0.5) throw std::invalid_argument("Load factor too high");
+      if (maxLoadFactor > MAX_LOAD_FACTOR) throw std::invalid_argument("Load factor too high");
       if (maxLoadFactor < 0.01) throw std::invalid_argument("Load factor too low");
       if (maxEntries < 2) throw std::invalid_argument("Too few entries");
+      if (INLINE and _capacity >= UINT32_MAX) throw std::invalid_argument("Too many entries for inline storage");
+      if (RELATIVE != (arrays != nullptr)) throw std::invalid_argument("Arrays given if and only if relative pointers");
 
-      table = new TableEntry[_capacity];
+      if constexpr (GROWABLE) {
+        _tableMaxSize = std::min(_maxSize, INITIAL_TABLE_ENTRIES);
+        _capacity = tableCapacity(_tableMaxSize, maxLoadFactor);
+      }
+      allocateArrays(static_cast<char*>(arrays));
+      if constexpr (not INLINE) pool.reserve(_tableMaxSize);
+      if constexpr (TINY_LFU) {
+        admission.sketch.init(maxSize());
+        admission.windowMaxSize = std::max((std::size_t) 1, maxSize() / 100);
+      }
 
       if (VERBOSE) std::cerr<<"Created hash table with max size "<<maxEntries
                             <<" and capacity "<<_capacity<<std::endl<<std::endl;
   }
 
+  //with WEIGHER: the total weight of the cached pairs is also bounded by 'maxWeight'
+  template<class W = Weigher, class = std::enable_if_t<not std::is_void<W>::value>>
+  ttl_cache(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction,
+            std::size_t maxWeight, const W& weigher = W()):
+    ttl_cache(maxEntries, maxLoadFactor, hashFunction)
+  {
+      if (maxWeight == 0) throw std::invalid_argument("Weight limit too low");
+      weights.weigher = weigher;
+      weights.maxWeight = maxWeight;
+  }
+
   ~ttl_cache() {
-    KeyValue* cur = LRU_oldest;
-    while (cur) {
-      KeyValue* next = cur->next;
-      delete cur;
-      cur = next;
+    if constexpr (not INLINE and (CLOCK or TINY_LFU)) {
+      for (std::size_t i = 0; i < _capacity; i++) {
+        if (not isEmpty(i)) pool.destroy(table[i].kv);
+      }
+    } else if constexpr (not INLINE) {
+      KeyValue* cur = LRU_oldest;
+      while (cur) {
+        KeyValue* next = cur->next;
+        pool.destroy(cur);
+        cur = next;
+      }
     }
-    delete table;
+    freeArrays();
+  }
+
+  //with RELATIVE_POINTERS, the size in bytes of the arrays of the table (see the constructor)
+  static std::size_t relativeArraysSize(std::size_t maxEntries, double maxLoadFactor) {
+    static_assert(RELATIVE, "the arrays are only placed by the user with RELATIVE_POINTERS");
+    return arraysSize(tableCapacity(maxEntries, maxLoadFactor));
   }
 
   //getters for basic info
@@ -140,79 +937,420 @@ public:
   bool empty() const { return _size == 0; }
   std::size_t capacity() const { return _capacity; }
   double loadFactor() const { return _size/(double) _capacity; }
+  std::size_t maxSize() const { return _maxSize; } //LRU eviction threshold
   timestamp_t currentTimeStamp() const { return currentTime; }
+  //the total weight of the cached pairs (including expired ones still in the table), and its bound
+  std::size_t weight() const {
+    static_assert(WEIGHTED, "weights require the WEIGHER option");
+    return weights.totalWeight;
+  }
+  std::size_t maxWeight() const {
+    static_assert(WEIGHTED, "weights require the WEIGHER option");
+    return weights.maxWeight;
+  }
+  template<class L = RemovalListener>
+  L& removalListener() {
+    static_assert(NOTIFIED, "removalListener requires the REMOVAL_LISTENER option");
+    return removals.listener;
+  }
 
+  /* the lookup key types accepted by get, insert and peek: Key itself or, if the hash function is
+     transparent (see ttl_cache_is_transparent), any type. a Key is only constructed from the lookup key
+     when insert adds a new pair, so e.g. a hit with a std::string_view does not allocate a std::string
+  */
+  template<class LookupKey, class T = void>
+  using enable_if_lookup_key = std::enable_if_t<TRANSPARENT or std::is_same<std::decay_t<LookupKey>, Key>::value, T>;
 
   std::optional<Value> get(const Key& key, timestamp_t timeStamp) {
+    return get<Key>(key, timeStamp);
+  }
 
-    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
+  template<class LookupKey, class = enable_if_lookup_key<LookupKey>>
+  std::optional<Value> get(const LookupKey& key, timestamp_t timeStamp) {
+    std::size_t index = getIndexAt(key, timeStamp);
+    if (index != invalidIndex()) return kvAt(index).value;
+    return {};
+  }
 
-    std::size_t hash = hashFunction(key);
-    std::size_t idealIndex = hashToIndex(hash);
-    if (VERBOSE) std::cerr<<"GET call: "<<key<<" (hash "<<hash
-                          <<", ideal pos "<<idealIndex<<") [at time: "<<timeStamp<<"]"<<std::endl;
+  /* zero-copy version of get: if the key is cached, calls 'visitor' with a const reference to its value
+     and returns true. the reference is only valid during the call, since any change to the cache
+     can move or remove the pair. e.g., for large values of which only a part is needed
+  */
+  template<class Visitor>
+  bool get_with(const Key& key, timestamp_t timeStamp, Visitor&& visitor) {
+    return get_with<Key, Visitor>(key, timeStamp, std::forward<Visitor>(visitor));
+  }
 
-    currentTime = timeStamp;
-    fixCluster(idealIndex);
+  template<class LookupKey, class Visitor, class = enable_if_lookup_key<LookupKey>>
+  bool get_with(const LookupKey& key, timestamp_t timeStamp, Visitor&& visitor) {
+    std::size_t index = getIndexAt(key, timeStamp);
+    if (index == invalidIndex()) return false;
+    visitor(static_cast<const Value&>(kvAt(index).value));
+    return true;
+  }
 
-    std::size_t actualIndex = findKey(key, hash);
-    if (actualIndex != invalidIndex()) {
-      assert(not isExpired(actualIndex));
+  /* the key and value are moved into the cache when they are rvalues (including the value of an update).
+     the overloads without a template are kept so that the arguments can still be implicitly converted
+     (e.g., string literals for std::string keys, or braced lists for the value)
+  */
+  void insert(const Key& key, const Value& value, timestamp_t timeStamp, timestamp_t ttl) {
+    emplace(key, timeStamp, ttl, value);
+  }
 
-      KeyValue* kv = table[actualIndex].kv;
-      LRU_moveToNewest(kv);
-      if (VERBOSE) std::cerr<<"GET result: found value "<< kv->value<<" for key "<<key
-                            <<" (at pos "<<actualIndex<<")"<<std::endl<<std::endl;
-      return kv->value;
-    }
+  void insert(Key&& key, Value&& value, timestamp_t timeStamp, timestamp_t ttl) {
+    emplace(std::move(key), timeStamp, ttl, std::move(value));
+  }
 
-    if (VERBOSE) std::cerr<<"GET result: not found"<<std::endl<<std::endl;
-    return {};
+  template<class LookupKey, class V, class = enable_if_lookup_key<LookupKey>>
+  void insert(LookupKey&& key, V&& value, timestamp_t timeStamp, timestamp_t ttl) {
+    emplace(std::forward<LookupKey>(key), timeStamp, ttl, std::forward<V>(value));
   }
 
-  void insert(const Key& key, const Value& value, timestamp_t timeStamp, timestamp_t ttl) {
+  /* like insert, but the value is constructed from 'valueArgs': in place if the pair is new, and
+     then assigned to the cached value if the key is already cached.
+     as for insert, the overloads with a Key rvalue allow implicit conversions of the key
+  */
+  template<class... ValueArgs>
+  void emplace(Key&& key, timestamp_t timeStamp, timestamp_t ttl, ValueArgs&&... valueArgs) {
+    emplace<Key, ValueArgs...>(std::move(key), timeStamp, ttl, std::forward<ValueArgs>(valueArgs)...);
+  }
+
+  template<class LookupKey, class... ValueArgs>
+  enable_if_lookup_key<LookupKey> emplace(LookupKey&& key, timestamp_t timeStamp, timestamp_t ttl,
+                                          ValueArgs&&... valueArgs) {
+    checkInsertion(timeStamp, ttl);
+    std::size_t hash = hashKey(key);
+    insertHashed(std::forward<LookupKey>(key), hash, jitterTtl(ttl, key), true, std::forward<ValueArgs>(valueArgs)...);
+  }
+
+  /* like emplace, but if the key is already cached (and not expired), its value and ttl are left
+     unchanged, and 'valueArgs' are not used (the pair still becomes the most recently used one).
+     returns whether a new pair was inserted
+  */
+  template<class... ValueArgs>
+  bool try_emplace(Key&& key, timestamp_t timeStamp, timestamp_t ttl, ValueArgs&&... valueArgs) {
+    return try_emplace<Key, ValueArgs...>(std::move(key), timeStamp, ttl, std::forward<ValueArgs>(valueArgs)...);
+  }
 
+  template<class LookupKey, class... ValueArgs>
+  enable_if_lookup_key<LookupKey, bool> try_emplace(LookupKey&& key, timestamp_t timeStamp, timestamp_t ttl,
+                                                    ValueArgs&&... valueArgs) {
+    checkInsertion(timeStamp, ttl);
+    std::size_t hash = hashKey(key);
+    return insertHashed(std::forward<LookupKey>(key), hash, jitterTtl(ttl, key), false,
+                        std::forward<ValueArgs>(valueArgs)...);
+  }
+
+  /* read-only version of get: returns the value of the key if it is cached and not expired at 'timeStamp'
+     (or at the current time stamp, if it is later), without changing the cache: the LRU order is not
+     updated, expired entries are not removed, and the current time stamp does not advance.
+     it does not use the helpers with preconditions (and their asserts), so that it can run
+     optimistically while a writer modifies the table, as in concurrent_ttl_cache (with inline storage).
+     with CLOCK_EVICTION, it still sets the reference bit of the entry, with a relaxed atomic store,
+     since that is the only state needed for approximate recency
+  */
+  std::optional<Value> peek(const Key& key, timestamp_t timeStamp) const {
+    return peek<Key>(key, timeStamp);
+  }
+
+  template<class LookupKey, class = enable_if_lookup_key<LookupKey>>
+  std::optional<Value> peek(const LookupKey& key, timestamp_t timeStamp) const {
+    std::size_t index = peekIndex(key, timeStamp);
+    if (index == invalidIndex()) return {};
+    if constexpr (CLOCK) storeRelaxed(referenced[index], (uint8_t) 1);
+    return kvAt(index).value;
+  }
+
+  //the time left before the key expires, if it is cached and not expired at 'timeStamp' (read as by peek)
+  std::optional<timestamp_t> remaining_ttl(const Key& key, timestamp_t timeStamp) const {
+    timeStamp = std::max(timeStamp, currentTime);
+    std::size_t index = peekIndex(key, timeStamp);
+    if (index == invalidIndex()) return {};
+    return expireTimeAt(index) - timeStamp;
+  }
+
+  /* returns the value of the key, after loading it with 'loader' (called with the key) and inserting it
+     with 'ttl' if it is not cached. with 'refreshAhead', it is also reloaded if it expires in at most
+     that time. the thread-safe caches coalesce concurrent loads of the same key (see single_flight.hpp)
+  */
+  template<class Loader>
+  Value get_or_load(const Key& key, timestamp_t timeStamp, Loader&& loader, timestamp_t ttl,
+                    timestamp_t refreshAhead = 0) {
+    std::size_t index = getIndexAt(key, timeStamp);
+    if (index != invalidIndex() and expireTimeAt(index) - currentTime > refreshAhead) return kvAt(index).value;
+    Value value = loader(key);
+    insert(key, value, timeStamp, ttl);
+    return value;
+  }
+
+  /* removes the key, if it is cached and not expired at 'timeStamp', and returns whether it was.
+     with STATS, erased pairs are counted as evictions
+  */
+  bool erase(const Key& key, timestamp_t timeStamp) {
+    return erase<Key>(key, timeStamp);
+  }
+
+  template<class LookupKey, class = enable_if_lookup_key<LookupKey>>
+  bool erase(const LookupKey& key, timestamp_t timeStamp) {
     if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
-    if (ttl <= 0) throw std::invalid_argument("insertion dead on arrival");
+    currentTime = timeStamp;
+    std::size_t index = findKey(key, hashKey(key));
+    if (index == invalidIndex() or isExpired(index)) return false;
+    if (VERBOSE) std::cerr<<"ERASE: key "<<key<<" from pos "<<index<<std::endl;
+    evictAt(index, ttl_cache_removal_cause::erased);
+    return true;
+  }
 
-    std::size_t hash = hashFunction(key);
-    std::size_t idealIndex = hashToIndex(hash);
-    if (VERBOSE) std::cerr<<"INSERT call: "<<key<<" = "<<value
-                          <<" (hash "<<hash<<", ideal pos "<<idealIndex<<") [lifespan: "
-                          <<timeStamp<<"-"<<timeStamp+ttl<<"]"<<std::endl;
+  /* batched versions of get and insert, for many keys at the same time stamp.
+     the keys are processed in groups: first, all the keys of a group are hashed and their
+     ideal table entries (and then their KeyValue nodes) are prefetched, so that the cache misses of
+     different keys overlap in time instead of happening one after the other. then, each key is
+     resolved exactly as with get/insert, in order.
 
+     get_many writes one std::optional<Value> per key to 'out'
+     insert_many takes a range of (key, value) pairs, all inserted with the same ttl
+  */
+  template<class KeyIterator, class OutputIterator>
+  void get_many(KeyIterator first, KeyIterator last, timestamp_t timeStamp, OutputIterator out) {
+
+    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
     currentTime = timeStamp;
-    fixCluster(idealIndex);
 
-    if ((_size+1) > maxLoadFactor * _capacity) {
-      LRU_evictOldest();
+    std::size_t hashes[BATCH_SIZE];
+    while (first != last) {
+      KeyIterator groupFirst = first;
+      unsigned int groupSize = prefetchGroup(first, last, hashes, [](const Key& key) -> const Key& { return key; });
+      for (unsigned int i = 0; i < groupSize; i++, ++groupFirst) {
+        std::size_t index = getIndex(*groupFirst, hashes[i]);
+        if (index != invalidIndex()) *out = std::optional<Value>(kvAt(index).value);
+        else *out = std::optional<Value>();
+        ++out;
+      }
     }
+  }
 
-    std::size_t actualIndex = findKey(key, hash);
-    if (actualIndex != invalidIndex()) {
-      KeyValue* kv = table[actualIndex].kv;
-      LRU_moveToNewest(kv);
-      if (VERBOSE) std::cerr<<"INSERT result: updated value for key "<<key
-                            <<" (at pos "<<actualIndex<<"): "
-                            <<kv->value<<" -> "<<value<<std::endl<<std::endl;
-      table[actualIndex].expireTime = timeStamp + ttl;
-      kv->value = value;
-      return;
+  template<class PairIterator>
+  void insert_many(PairIterator first, PairIterator last, timestamp_t timeStamp, timestamp_t ttl) {
+
+    checkInsertion(timeStamp, ttl);
+
+    std::size_t hashes[BATCH_SIZE];
+    while (first != last) {
+      PairIterator groupFirst = first;
+      unsigned int groupSize = prefetchGroup(first, last, hashes, [](const auto& pair) -> const Key& { return pair.first; });
+      for (unsigned int i = 0; i < groupSize; i++, ++groupFirst) {
+        insertHashed(groupFirst->first, hashes[i], jitterTtl(ttl, groupFirst->first), true, groupFirst->second);
+      }
     }
+  }
 
-    std::size_t newIndex = nextEmpty(idealIndex);
-    auto kv = new KeyValue(key, value);
-    table[newIndex].kv = kv;
-    table[newIndex].hash = hash;
-    table[newIndex].expireTime = timeStamp + ttl;
+  /* changes the maximum number of pairs (as 'maxEntries' at construction), keeping the cached pairs with
+     their LRU order and expire times. if there are more pairs than the new maximum, the extra ones are
+     evicted first, following the eviction policy. the table is then rebuilt for the new maximum
+     (with GROWABLE_TABLE, it is only rebuilt if it is larger than needed, and grows again on demand).
+     like a rebuild of a growable table, it takes time proportional to the number of pairs.
+     the memory of the node pool is not released when the cache shrinks, but it is reused if it grows again
+  */
+  void resize(std::size_t maxEntries) {
+    static_assert(not RELATIVE, "the table cannot be reallocated with RELATIVE_POINTERS");
+    if (maxEntries < 2) throw std::invalid_argument("Too few entries");
+    std::size_t newCapacity = tableCapacity(maxEntries, maxLoadFactor);
+    if (INLINE and newCapacity >= UINT32_MAX) throw std::invalid_argument("Too many entries for inline storage");
+    std::size_t newMaxSize = std::min(maxEntries, (std::size_t) (maxLoadFactor * newCapacity));
+
+    while (_size > newMaxSize) evictOne();
+    _maxSize = newMaxSize;
+    if constexpr (TINY_LFU) {
+      admission.sketch.init(maxSize());
+      admission.windowMaxSize = std::max((std::size_t) 1, maxSize() / 100);
+      while (admission.windowSize > admission.windowMaxSize) TINY_LFU_moveToMain(admission.windowOldest);
+    }
+    if constexpr (GROWABLE) rebuildTable(std::min(_tableMaxSize, _maxSize));
+    else rebuildTable(_maxSize);
+  }
 
-    LRU_insertNewest(kv);
-    _size++;
+  /* with GROWABLE_TABLE, grows the table now so that it can hold 'numEntries' pairs (at most maxSize())
+     without being rebuilt. without it, the table already has room for maxSize() pairs
+  */
+  void reserve(const std::size_t numEntries) {
+    if constexpr (GROWABLE) {
+      std::size_t tableMaxSize = std::min(numEntries, _maxSize);
+      if (tableMaxSize > _tableMaxSize) rebuildTable(tableMaxSize);
+    }
+  }
 
-    assert(findKey(key) != invalidIndex());
-    if (VERBOSE) std::cerr<<"INSERT result: inserted new entry "<<key
-                          <<" = "<<value<<" (at pos "<<newIndex<<")"<<std::endl<<std::endl;
+  /* fills an empty cache with a range of (key, value, ttl) tuples (read with std::get, e.g. std::tuple),
+     inserted at 'timeStamp', in much less time than inserting them one by one: all the keys are hashed
+     first (by 'numThreads' threads, if it is more than 1), and then the pairs are placed directly in the
+     table, in a single pass, where a rebuild of the table would put them (an empty cache has no expired
+     entries to remove), while the table entries of the next pairs are prefetched. their nodes come from
+     the node pool, which is already allocated for the whole table (with GROWABLE_TABLE, the table is
+     grown once, to the size needed for the range).
+     the LRU order follows the range: its last pair is the most recently used one. if the range has more
+     pairs than maxSize(), only the last maxSize() are inserted. a key that appears more than once is
+     updated as by insert. the range is traversed several times, so it needs forward iterators, and the
+     tuples are copied from it (or moved from, with move iterators). returns the number of cached pairs
+  */
+  template<class TupleIterator>
+  std::size_t bulk_load(TupleIterator first, TupleIterator last, timestamp_t timeStamp, unsigned int numThreads = 1) {
+    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
+    if (_size > 0) throw std::invalid_argument("bulk loads require an empty cache");
+    std::size_t numPairs = 0;
+    for (TupleIterator it = first; it != last; ++it, numPairs++) {
+      if (std::get<2>(*it) <= 0) throw std::invalid_argument("insertion dead on arrival");
+    }
+    currentTime = timeStamp;
+    if (numPairs > _maxSize) {
+      std::advance(first, numPairs - _maxSize);
+      numPairs = _maxSize;
+    }
+    if (VERBOSE) std::cerr<<"BULK LOAD: "<<numPairs<<" pairs [at time: "<<currentTime<<"]"<<std::endl;
+    reserve(numPairs);
+
+    std::vector<std::size_t> hashes(numPairs);
+    auto hashRange = [this, &hashes](TupleIterator it, std::size_t begin, const std::size_t end) {
+      for (; begin < end; ++it, begin++) hashes[begin] = hashKey(std::get<0>(*it));
+    };
+    numThreads = std::max(1u, std::min(numThreads, (unsigned int) (numPairs / MIN_HASHES_PER_THREAD)));
+    if (numThreads == 1) {
+      hashRange(first, 0, numPairs);
+    } else {
+      std::vector<std::thread> threads;
+      TupleIterator it = first;
+      for (unsigned int t = 0; t < numThreads; t++) {
+        std::size_t begin = numPairs * t / numThreads, end = numPairs * (t+1) / numThreads;
+        threads.emplace_back(hashRange, it, begin, end);
+        std::advance(it, end - begin);
+      }
+      for (std::thread& thread : threads) thread.join();
+    }
 
+    std::size_t i = 0;
+    for (; i < std::min(numPairs, (std::size_t) BATCH_SIZE); i++) prefetch(&table[hashToIndex(hashes[i])]);
+    for (i = 0; i < numPairs; i++, ++first) {
+      if (i + BATCH_SIZE < numPairs) prefetch(&table[hashToIndex(hashes[i + BATCH_SIZE])]);
+      auto&& tuple = *first;
+      timestamp_t ttl = jitterTtl(std::get<2>(tuple), std::get<0>(tuple));
+      placeEntry(std::get<0>(std::forward<decltype(tuple)>(tuple)), hashes[i], ttl,
+                 std::get<1>(std::forward<decltype(tuple)>(tuple)));
+    }
+    return _size;
+  }
+
+  /* snapshots, to warm up a new cache (e.g., after a restart) with the pairs of another one.
+     save writes the pairs that are not expired at 'timeStamp' (or at the current time stamp, if it is
+     later) to the file at 'path', with their remaining ttls, in eviction order: from the least recently
+     used pair to the most recently used one (the main list first, then the window, with TINY_LFU; and
+     in table order with CLOCK_EVICTION, which does not keep an order). it does not change the cache.
+     the keys and values are written with the serializers (see ttl_cache_serializer).
+     returns the number of saved pairs.
+
+     the format is binary and not portable across architectures: a header (magic, version, size of the
+     time stamps, number of pairs), and then, for each pair, its remaining ttl, the sizes of its key and
+     value in bytes (32 bits each), and their bytes
+  */
+  template<class KeySerializer = ttl_cache_serializer<Key>, class ValueSerializer = ttl_cache_serializer<Value>>
+  std::size_t save(const std::string& path, timestamp_t timeStamp,
+                   const KeySerializer& keySerializer = KeySerializer(),
+                   const ValueSerializer& valueSerializer = ValueSerializer()) const {
+    timeStamp = std::max(timeStamp, currentTime);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (not file) throw std::runtime_error("cannot create snapshot file " + path);
+
+    SnapshotHeader header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.timestampSize = sizeof(timestamp_t);
+    header.count = 0;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<char> record;
+    auto saveEntry = [&](const std::size_t index) {
+      timestamp_t expireTime = expireTimeAt(index);
+      if (timeStamp >= expireTime) return;
+      const KeyValue& kv = kvAt(index);
+      std::size_t keySize = keySerializer.size(kv.key), valueSize = valueSerializer.size(kv.value);
+      if (keySize > UINT32_MAX or valueSize > UINT32_MAX) throw std::length_error("pair too large for a snapshot");
+      record.resize(SNAPSHOT_RECORD_HEADER + keySize + valueSize);
+      timestamp_t ttl = expireTime - timeStamp;
+      uint32_t sizes[2] = {(uint32_t) keySize, (uint32_t) valueSize};
+      std::memcpy(record.data(), &ttl, sizeof(ttl));
+      std::memcpy(record.data() + sizeof(ttl), sizes, sizeof(sizes));
+      keySerializer.write(kv.key, record.data() + SNAPSHOT_RECORD_HEADER);
+      valueSerializer.write(kv.value, record.data() + SNAPSHOT_RECORD_HEADER + keySize);
+      file.write(record.data(), record.size());
+      header.count++;
+    };
+    if constexpr (CLOCK) {
+      for (std::size_t i = 0; i < _capacity; i++) {
+        if (not isEmpty(i)) saveEntry(i);
+      }
+    } else {
+      for (node_t node = LRU_oldest; node != NIL; node = kvOf(node).next) saveEntry(indexOf(node));
+      if constexpr (TINY_LFU) {
+        for (node_t node = admission.windowOldest; node != NIL; node = kvOf(node).next) saveEntry(indexOf(node));
+      }
+    }
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (not file.flush()) throw std::runtime_error("cannot write snapshot file " + path);
+    return header.count;
+  }
+
+  /* loads a snapshot written by save into this cache, which must be empty, at 'timeStamp': each pair
+     expires after its remaining ttl at the time it was saved. the pairs are inserted in the saved order,
+     so the LRU order is restored (with TINY_LFU, the newest pairs are in the window). if there are more
+     pairs than maxSize(), the oldest ones are skipped.
+     the file is memory-mapped, and the pairs are placed directly in the table (they are known to be new,
+     and there are no expired entries in the table to remove), so loading costs about as much as a
+     rebuild of the table. with GROWABLE_TABLE, the table is grown once for all of them.
+     returns the number of pairs loaded (with WEIGHER, the ones still cached after fitting the budget).
+     throws std::runtime_error if the file is not a valid snapshot (the pairs before the error stay loaded)
+  */
+  template<class KeySerializer = ttl_cache_serializer<Key>, class ValueSerializer = ttl_cache_serializer<Value>>
+  std::size_t load(const std::string& path, timestamp_t timeStamp,
+                   const KeySerializer& keySerializer = KeySerializer(),
+                   const ValueSerializer& valueSerializer = ValueSerializer()) {
+    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
+    if (_size > 0) throw std::invalid_argument("snapshots can only be loaded into an empty cache");
+    currentTime = timeStamp;
+
+    ttl_cache_mapped_file file(path);
+    const char* cur = file.data();
+    const char* end = cur + file.size();
+    SnapshotHeader header;
+    if (file.size() < sizeof(header)) throw std::runtime_error("invalid snapshot file " + path);
+    std::memcpy(&header, cur, sizeof(header));
+    cur += sizeof(header);
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 or
+        header.version != SNAPSHOT_VERSION or header.timestampSize != sizeof(timestamp_t)) {
+      throw std::runtime_error("invalid snapshot file " + path);
+    }
+    if (VERBOSE) std::cerr<<"LOAD: "<<header.count<<" pairs from "<<path<<std::endl;
+
+    std::size_t numSkipped = header.count > _maxSize ? header.count - _maxSize : 0;
+    reserve(header.count - numSkipped);
+    for (uint64_t i = 0; i < header.count; i++) {
+      timestamp_t ttl;
+      uint32_t sizes[2];
+      if (end - cur < (std::ptrdiff_t) SNAPSHOT_RECORD_HEADER) throw std::runtime_error("truncated snapshot file " + path);
+      std::memcpy(&ttl, cur, sizeof(ttl));
+      std::memcpy(sizes, cur + sizeof(ttl), sizeof(sizes));
+      cur += SNAPSHOT_RECORD_HEADER;
+      if ((std::size_t) (end - cur) < (std::size_t) sizes[0] + sizes[1]) {
+        throw std::runtime_error("truncated snapshot file " + path);
+      }
+      const char* keyBytes = cur;
+      const char* valueBytes = cur + sizes[0];
+      cur += (std::size_t) sizes[0] + sizes[1];
+      if (i < numSkipped or ttl <= 0) continue;
+
+      Key key = keySerializer.read(keyBytes, sizes[0]);
+      std::size_t hash = hashKey(key);
+      placeEntry(std::move(key), hash, ttl, valueSerializer.read(valueBytes, sizes[1]));
+    }
+    return _size;
   }
 
   /* Expire algorithm from Redis
@@ -224,11 +1362,19 @@ public:
      "1. Test 20 random keys from the set of keys with an associated expire.
       2. Delete all the keys found expired.
       3. If more than 25% of keys were expired, start again from step 1."
+
+     the random keys are taken a whole cluster at a time (since fixing a cluster removes all its
+     expired entries anyway), until at least 20 entries have been examined.
+     it does not allocate memory, so it can run in a latency-sensitive thread.
+     'maxExamined' bounds the work (the number of examined entries) of a single call,
+     which can then stop before reaching the target ratio. the bound is checked between clusters
+
+     returns the expired ratio of the last sample (or 0 if no sample could be taken)
   */
-  void removeExpired(timestamp_t timeStamp, double targetRatio) {
+  double removeExpired(timestamp_t timeStamp, double targetRatio,
+                       std::size_t maxExamined = std::numeric_limits<std::size_t>::max()) {
 
     static constexpr double MIN_LOAD_FACTOR = 0.1;
-    static constexpr unsigned int MIN_SAMPLE_SIZE = 20;
     static constexpr double MIN_TARGET_RATIO = 0.01;
 
     if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
@@ -238,10 +1384,12 @@ public:
                           <<", target expired ratio: "<<targetRatio<<", at time: ["<<timeStamp<<"]"<<std::endl;
 
     currentTime = timeStamp;
+    if constexpr (STATS) _stats.expireCalls++;
     
-    double expiredRatio;
+    double expiredRatio = 0;
+    std::size_t totalExamined = 0;
 
-    while (true) {
+    while (totalExamined < maxExamined) {
 
       if (loadFactor() < MIN_LOAD_FACTOR) {
         if (VERBOSE) std::cerr<<"expire stopped because the load factor ("<<loadFactor()<<") is"
@@ -254,102 +1402,740 @@ public:
         break;
       }
 
-      std::size_t beforeSize = _size;
+      std::size_t beforeSize = _size;
+      std::size_t sampleSize = 0;
+      unsigned int numSampledClusters = 0;
+
+      while (sampleSize < MIN_SAMPLE_SIZE and totalExamined < maxExamined) {
+        std::size_t index = randomIndex();
+        while (isEmpty(index)) index = randomIndex();
+
+        if (isInSampledCluster(index, numSampledClusters)) continue;
+
+        std::size_t startIndex = findClusterStart(index);
+        std::size_t length = entryDist(startIndex, nextEmpty(index));
+        sampledClusters[numSampledClusters++] = {startIndex, length};
+        sampleSize += length;
+        totalExamined += length;
+        fixCluster(index); //this removes the expired entries in the cluster, updating _size in the process
+      }
+
+      unsigned int expiredCount = (beforeSize - _size);
+      expiredRatio = expiredCount / (double) sampleSize;
+      if constexpr (STATS) {
+        _stats.expireRounds++;
+        _stats.expireSampled += sampleSize;
+        _stats.expireRemoved += expiredCount;
+        _stats.lastExpiredRatio = expiredRatio;
+      }
+
+
+      if (VERBOSE) std::cerr<<"sampled "<<sampleSize<<" random keys, removed "<<expiredCount
+                            <<" expired keys ("<<100.0*expiredRatio<<"%)"<<std::endl;
+      if (expiredRatio <= targetRatio) break;
+    }
+
+    if (VERBOSE) std::cerr<<"EXPIRE result: size: "<<_size<<", load factor: "<<loadFactor()
+                          <<", last sample expired ratio: "<<100.0*expiredRatio<<"%"<<std::endl<<std::endl;
+    return expiredRatio;
+  }
+
+  /* removes all the entries expired at 'timeStamp' using the timing wheel (requires TIMER_WHEEL).
+     in contrast to removeExpired, it is exact and does not use random samples: its running time is
+     proportional to the number of removed entries (plus the number of entries in the wheel bucket of
+     the current time, and the number of cascaded entries).
+     'maxRemoved' bounds the work of a single call when many entries expire at once: the call stops
+     once it has removed that many entries (checked between removals, each of which may also remove
+     a few other expired entries in its way), and the next calls continue from there.
+     returns whether all the expired entries were removed
+  */
+  bool removeExpiredUntil(timestamp_t timeStamp,
+                          std::size_t maxRemoved = std::numeric_limits<std::size_t>::max()) {
+    static_assert(TIMER_WHEEL, "removeExpiredUntil requires the TIMER_WHEEL option");
+
+    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
+
+    if (VERBOSE) std::cerr<<"EXPIRE UNTIL call: size: "<<_size<<", at time: ["<<timeStamp<<"]"<<std::endl;
+
+    currentTime = timeStamp;
+    std::size_t beforeSize = _size;
+    bool finished = wheelAdvance(wheelTick(timeStamp), maxRemoved);
+    if constexpr (STATS) _stats.expireRemoved += beforeSize - _size;
+
+    if (VERBOSE) std::cerr<<"EXPIRE UNTIL result: removed "<<beforeSize - _size<<" expired keys, size: "
+                          <<_size<<(finished ? "" : " (stopped by the budget)")<<std::endl<<std::endl;
+    return finished;
+  }
+
+
+  /* snapshot of the statistics (requires the STATS option).
+     the cluster length histogram is computed at this point, in time proportional to the capacity
+  */
+  ttl_cache_stats stats() const {
+    static_assert(STATS, "stats requires the STATS option");
+    ttl_cache_stats res = _stats;
+    for (std::size_t& count : res.clusterLengthHistogram) count = 0;
+    if (_size == 0) return res;
+    //start at an empty entry so that no cluster wraps around the start
+    std::size_t start = nextEmpty(0);
+    std::size_t index = start, length = 0;
+    do {
+      index = nextIndex(index);
+      if (not isEmpty(index)) {
+        length++;
+      } else if (length > 0) {
+        res.clusterLengthHistogram[ttl_cache_stats::histogramBucket(length)]++;
+        length = 0;
+      }
+    } while (index != start);
+    return res;
+  }
+
+  void resetStats() {
+    static_assert(STATS, "resetStats requires the STATS option");
+    _stats = ttl_cache_stats();
+  }
+
+  /* seeds the random number generator of the cache (seeded from the clock at construction), which drives
+     the samples of removeExpired, TTL_JITTER, and reseed. with the same seed, options and operations,
+     two caches end up in the same state, e.g., to replay a trace (see ttl_cache_trace.hpp)
+  */
+  void seedRandom(uint64_t seed) { RNG.seed(seed); }
+
+  //the state of the probe length monitor (requires the PROBE_MONITOR option)
+  ttl_cache_probe_report probeReport() const {
+    static_assert(PROBE_MONITOR, "probeReport requires the PROBE_MONITOR option");
+    return monitor.report;
+  }
+
+  /* rebuilds the table, with the same size, after changing the hash seed (requires HASH_MIXER or
+     POW2_CAPACITY), so that the keys move to other positions and their clusters are broken up.
+     like resize, it takes time proportional to the number of pairs. see PROBE_MONITOR for when to call it.
+     with TINY_LFU, the frequency sketch (which is indexed by hash) starts over
+  */
+  void reseed() {
+    static_assert(MIXED, "reseed requires the HASH_MIXER or POW2_CAPACITY option");
+    static_assert(not RELATIVE, "the table cannot be reallocated with RELATIVE_POINTERS");
+    rebuildTable(_tableMaxSize, true);
+  }
+
+
+  void print() const {
+    std::cout<<"State [at time "<<currentTime<<"]"<<std::endl<<std::endl;
+    printTable();
+    if constexpr (not CLOCK) {
+      std::cout<<std::endl<<"LRU order: "<<std::endl;
+      printLRUOrder(LRU_oldest);
+    }
+    if constexpr (TINY_LFU) {
+      std::cout<<"Window LRU order: "<<std::endl;
+      printLRUOrder(admission.windowOldest);
+    }
+    std::cout<<std::endl;
+  }
+
+  //with TINY_LFU, the main list followed by the window list
+  std::vector<Key> LRU_order() {
+    static_assert(not CLOCK, "LRU_order is not available with CLOCK_EVICTION");
+    std::vector<Key> res;
+    res.reserve(_size);
+    node_t cur = LRU_oldest;
+    while (cur != NIL) {
+      res.push_back(kvOf(cur).key);
+      cur = kvOf(cur).next;
+    }    
+    if constexpr (TINY_LFU) {
+      for (cur = admission.windowOldest; cur != NIL; cur = kvOf(cur).next) res.push_back(kvOf(cur).key);
+    }
+    return res;
+  }
+
+
+
+
+private:
+
+  static std::size_t tableCapacity(const std::size_t maxEntries, const double maxLoadFactor) {
+    std::size_t capacity = (std::size_t) ceil(maxEntries/maxLoadFactor);
+    if constexpr (POW2) {
+      std::size_t pow2 = 1;
+      while (pow2 < capacity) pow2 *= 2;
+      capacity = pow2;
+    }
+    return capacity;
+  }
+
+  //with POW2_CAPACITY, all the index computations below are masks instead of modulo operations
+  inline std::size_t indexMask() const {
+    return _capacity - 1;
+  }
+
+  inline std::size_t nextIndex(const std::size_t index) const {
+    if constexpr (POW2) return (index + 1) & indexMask();
+    else return (index + 1)%_capacity;
+  }
+
+  inline std::size_t prevIndex(const std::size_t index) const {
+    if constexpr (POW2) return (index - 1) & indexMask();
+    else return (index + _capacity - 1)%_capacity;
+  }
+
+  inline std::size_t invalidIndex() const {
+    return _capacity; //arbitrary value outside the valid range
+  }
+
+  inline std::size_t randomIndex() {
+    if constexpr (POW2) return (std::size_t) RNG() & indexMask();
+    else return (std::size_t) RNG()%_capacity;
+  }
+
+  inline std::size_t hashToIndex(const std::size_t hash) const {
+    if constexpr (POW2) return hash & indexMask();
+    else return hash % _capacity;
+  }
+
+  inline std::size_t entryDist(const std::size_t index1, const std::size_t index2) const {
+    if constexpr (POW2) return (index2 - index1) & indexMask();
+    if (index1 <= index2) return index2 - index1;
+    return index2 + _capacity - index1;
+  }
+
+  inline std::size_t entryIndex(const TableEntry* entry) const {
+    return (entry - &table)/sizeof(TableEntry);
+  }
+
+  /*** get/insert implementation, after checking and updating the time stamp ***/
+
+  /* for peek: the index of the key if it is cached and not expired at 'timeStamp' (or at the current time
+     stamp, if it is later), without changing the cache
+  */
+  template<class LookupKey>
+  std::size_t peekIndex(const LookupKey& key, timestamp_t timeStamp) const {
+    timeStamp = std::max(timeStamp, currentTime);
+    const std::size_t hash = hashKey(key);
+    std::size_t dist = 0;
+    //bounded by the capacity in case concurrent writes make the table look full
+    for (auto idx = hashToIndex(hash); not isEmpty(idx) and dist < _capacity; idx = nextIndex(idx), dist++) {
+      if (ROBIN_HOOD and entryDist(hashToIndex(hashAt(idx)), idx) < dist) break;
+      bool match;
+      if constexpr (INLINE) match = table[idx].kv.key == key;
+      else match = table[idx].hash == hash and table[idx].kv->key == key;
+      if (match) {
+        if (timeStamp >= expireTimeAt(idx)) break;
+        return idx;
+      }
+    }
+    return invalidIndex();
+  }
+
+  //checks and updates the time stamp, and then calls getIndex
+  template<class LookupKey>
+  std::size_t getIndexAt(const LookupKey& key, const timestamp_t timeStamp) {
+    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
+    currentTime = timeStamp;
+    return getIndex(key, hashKey(key));
+  }
+
+  /* checks the arguments of an insertion, and updates the time stamp. with REBUILD_ON_ALARM, it also
+     runs a pending reseed, since that has to happen before the keys of the insertion are hashed
+  */
+  void checkInsertion(const timestamp_t timeStamp, const timestamp_t ttl) {
+    if (timeStamp < currentTime) throw std::invalid_argument("attempt to time travel");
+    if (ttl <= 0) throw std::invalid_argument("insertion dead on arrival");
+    currentTime = timeStamp;
+    if constexpr (REBUILD_ON_ALARM) {
+      if (monitor.reseedPending) reseed();
+    }
+  }
+
+  /* with TTL_JITTER, the ttl shortened by a fraction in [0, TTL_JITTER). the result is still positive.
+     it is applied by the public insertions (not insertHashed, which also updates the pairs of snapshots)
+  */
+  template<class LookupKey>
+  timestamp_t jitterTtl(const timestamp_t ttl, const LookupKey& key) {
+    if constexpr (TTL_JITTER == 0) return ttl;
+    else {
+      uint64_t bits;
+      if constexpr (HASHED_JITTER) bits = static_cast<uint64_t>(hashFunction(key)) * 0x9E3779B97F4A7C15ull;
+      else bits = RNG();
+      double fraction = (bits >> 11) * 0x1.0p-53 * TTL_JITTER; //53 random bits, in [0, 1)
+      return ttl - static_cast<timestamp_t>(ttl * fraction);
+    }
+  }
+
+  //returns the index of the key, after moving it to the end of the LRU order, or invalidIndex()
+  template<class LookupKey>
+  std::size_t getIndex(const LookupKey& key, const std::size_t hash) {
+
+    std::size_t idealIndex = hashToIndex(hash);
+    if (VERBOSE) std::cerr<<"GET call: "<<key<<" (hash "<<hash
+                          <<", ideal pos "<<idealIndex<<") [at time: "<<currentTime<<"]"<<std::endl;
+    if constexpr (TINY_LFU) admission.sketch.record(hash);
+
+    std::size_t actualIndex, stopIndex = idealIndex;
+    if constexpr (LAZY_GET) {
+      actualIndex = findKey(key, hash, stopIndex);
+      countProbe(idealIndex, actualIndex != invalidIndex() ? actualIndex : stopIndex);
+      if (actualIndex != invalidIndex() and isExpired(actualIndex)) {
+        if (VERBOSE) std::cerr<<"GET: key "<<key<<" is expired, left as a tombstone"<<std::endl;
+        actualIndex = invalidIndex();
+      }
+    } else {
+      if constexpr (ROBIN_HOOD) {
+        actualIndex = probeRemovingExpired(key, hash, stopIndex);
+      } else {
+        fixCluster(idealIndex);
+        actualIndex = findKey(key, hash, stopIndex);
+      }
+      countProbe(idealIndex, actualIndex != invalidIndex() ? actualIndex : stopIndex);
+    }
+
+    if constexpr (STATS) {
+      _stats.gets++;
+      if (actualIndex != invalidIndex()) _stats.hits++;
+      else _stats.misses++;
+    }
+
+    if (actualIndex != invalidIndex()) {
+      assert(not isExpired(actualIndex));
+
+      markAccessed(actualIndex);
+      if (VERBOSE) std::cerr<<"GET result: found value "<< kvAt(actualIndex).value<<" for key "<<key
+                            <<" (at pos "<<actualIndex<<")"<<std::endl<<std::endl;
+      return actualIndex;
+    }
+
+    if (VERBOSE) std::cerr<<"GET result: not found"<<std::endl<<std::endl;
+    return invalidIndex();
+  }
+
+  /* the Key is only constructed (from the lookup key) if the pair is new, and the value is constructed
+     in place from 'valueArgs'. if the key is already cached, its value is replaced (or, if 'assign' is
+     false, left unchanged). returns whether a new pair was inserted
+  */
+  template<class LookupKey, class... ValueArgs>
+  bool insertHashed(LookupKey&& key, const std::size_t hash, const timestamp_t ttl, const bool assign,
+                    ValueArgs&&... valueArgs) {
+
+    growIfFull();
+    const timestamp_t timeStamp = currentTime;
+    std::size_t idealIndex = hashToIndex(hash);
+    if (VERBOSE) std::cerr<<"INSERT call: "<<key
+                          <<" (hash "<<hash<<", ideal pos "<<idealIndex<<") [lifespan: "
+                          <<timeStamp<<"-"<<timeStamp+ttl<<"]"<<std::endl;
+
+    if constexpr (not ROBIN_HOOD) fixCluster(idealIndex);
+    if constexpr (TINY_LFU) admission.sketch.record(hash);
+
+    if ((_size+1) > _maxSize) {
+      evictOne();
+    }
+
+    std::size_t actualIndex, stopIndex = idealIndex;
+    if constexpr (ROBIN_HOOD) actualIndex = probeRemovingExpired(key, hash, stopIndex);
+    else actualIndex = findKey(key, hash, stopIndex);
+    countProbe(idealIndex, actualIndex != invalidIndex() ? actualIndex : stopIndex);
+
+    if (actualIndex != invalidIndex()) {
+      markAccessed(actualIndex);
+      if (not assign) {
+        if (VERBOSE) std::cerr<<"INSERT result: key "<<key<<" already cached (at pos "
+                              <<actualIndex<<"), left unchanged"<<std::endl<<std::endl;
+        return false;
+      }
+      if constexpr (STATS) _stats.updates++;
+      KeyValue& kv = kvAt(actualIndex);
+      setExpireTime(actualIndex, timeStamp + ttl);
+      if constexpr (TIMER_WHEEL) {
+        wheelRemove(nodeAt(actualIndex));
+        wheelAdd(nodeAt(actualIndex), expireTimeAt(actualIndex));
+      }
+      assignValue(kv.value, std::forward<ValueArgs>(valueArgs)...);
+      if (VERBOSE) std::cerr<<"INSERT result: updated value for key "<<key
+                            <<" (at pos "<<actualIndex<<") to "<<kv.value<<std::endl<<std::endl;
+      if constexpr (WEIGHTED) {
+        weights.totalWeight -= kv.weight;
+        weighPair(actualIndex);
+      }
+      return false;
+    }
+
+    std::size_t newIndex;
+    if constexpr (ROBIN_HOOD) {
+      newIndex = stopIndex;
+      makeRoomAt(newIndex);
+    } else {
+      newIndex = nextEmpty(idealIndex);
+    }
+    setEntry(newIndex, hash, timeStamp + ttl, std::forward<LookupKey>(key), std::forward<ValueArgs>(valueArgs)...);
+    if constexpr (TIMER_WHEEL) wheelAdd(nodeAt(newIndex), expireTimeAt(newIndex));
+
+    markInserted(newIndex);
+    _size++;
+    if constexpr (STATS) _stats.inserts++;
+
+    //the lookup key may have been moved into the pair
+    assert(findKey(kvAt(newIndex).key, hash) == newIndex);
+    if (VERBOSE) std::cerr<<"INSERT result: inserted new entry "<<kvAt(newIndex).key
+                          <<" = "<<kvAt(newIndex).value<<" (at pos "<<newIndex<<")"<<std::endl<<std::endl;
+    if constexpr (WEIGHTED) weighPair(newIndex);
+    return true;
+  }
+
+  /* with WEIGHER, computes the weight of the pair at index (just inserted or updated), and then evicts
+     pairs until the total weight fits in the budget. if the pair does not fit on its own,
+     it is evicted right away instead of flushing the cache. the table may have changed afterwards
+  */
+  void weighPair(const std::size_t index) {
+    KeyValue& kv = kvAt(index);
+    kv.weight = weights.weigher(static_cast<const Key&>(kv.key), static_cast<const Value&>(kv.value));
+    weights.totalWeight += kv.weight;
+    if (kv.weight > weights.maxWeight) {
+      if (VERBOSE) std::cerr<<"WEIGHT: key "<<kv.key<<" is heavier than the limit ("<<kv.weight
+                            <<" > "<<weights.maxWeight<<")"<<std::endl;
+      LRU_evict(nodeAt(index));
+    }
+    while (weights.totalWeight > weights.maxWeight) evictOne();
+  }
+
+  //assigns the value directly if possible, so that e.g. an rvalue is moved without a temporary
+  template<class... ValueArgs>
+  static inline void assignValue(Value& value, ValueArgs&&... valueArgs) {
+    if constexpr (sizeof...(ValueArgs) == 1) {
+      if constexpr (std::is_assignable<Value&, ValueArgs&&...>::value) {
+        value = (std::forward<ValueArgs>(valueArgs), ...);
+        return;
+      }
+    }
+    value = Value(std::forward<ValueArgs>(valueArgs)...);
+  }
+
+  /*** table rebuilding (resize, and GROWABLE_TABLE) ***/
+
+  //with GROWABLE_TABLE, doubles the table if it has no room for one more pair
+  inline void growIfFull() {
+    if constexpr (GROWABLE) {
+      if (_size + 1 > _tableMaxSize and _tableMaxSize < _maxSize) {
+        rebuildTable(std::min(2 * _tableMaxSize, _maxSize));
+      }
+    }
+  }
+
+  //a pair taken out of the table while it is rebuilt
+  struct MigratedEntry {
+    typename std::conditional<INLINE, KeyValue, KeyValue*>::type kv;
+    std::size_t hash;
+    timestamp_t expireTime;
+    bool referenced;
+  };
+
+  /* replaces the table with one sized for 'tableMaxSize' pairs, and reinserts all the pairs into it
+     in eviction order (oldest first, for each list), so that the LRU lists are rebuilt in the same order.
+     the expire times and the timing wheel are preserved, and so are the CLOCK reference bits (but not
+     the position of the hand). with inline storage, the nodes are indices, so all the links are rebuilt.
+     with 'newSeed', the hash seed changes, and the pairs are reinserted with their new hashes
+  */
+  void rebuildTable(const std::size_t tableMaxSize, const bool newSeed = false) {
+    std::size_t newCapacity = tableCapacity(tableMaxSize, maxLoadFactor);
+    if (VERBOSE) std::cerr<<"REBUILD: from capacity "<<_capacity<<" to "<<newCapacity
+                          <<" for "<<tableMaxSize<<" pairs"<<std::endl;
+
+    std::vector<MigratedEntry> entries;
+    entries.reserve(_size);
+    auto takeEntry = [this, &entries](const std::size_t index) {
+      entries.push_back({table[index].kv, hashAt(index), expireTimeAt(index),
+                         CLOCK and referenced[index]});
+    };
+    if constexpr (CLOCK) {
+      for (std::size_t i = 0; i < _capacity; i++) {
+        if (not isEmpty(i)) takeEntry(i);
+      }
+    } else {
+      for (node_t node = LRU_oldest; node != NIL; node = kvOf(node).next) takeEntry(indexOf(node));
+      if constexpr (TINY_LFU) {
+        for (node_t node = admission.windowOldest; node != NIL; node = kvOf(node).next) takeEntry(indexOf(node));
+      }
+    }
+    assert(entries.size() == _size);
+
+    if (newSeed) {
+      hashSeed = (std::size_t) RNG();
+      for (MigratedEntry& entry : entries) entry.hash = hashKey(migratedKey(entry));
+      if constexpr (TINY_LFU) admission.sketch.init(maxSize());
+      if constexpr (PROBE_MONITOR) {
+        monitor.report.reseeds++;
+        monitor.searchesSinceReseed = 0;
+        monitor.reseedPending = false;
+      }
+    }
+
+    freeArrays();
+    _capacity = newCapacity;
+    _tableMaxSize = tableMaxSize;
+    allocateArrays(nullptr);
+    if constexpr (not INLINE) pool.reserve(_tableMaxSize);
+    clockHand = 0;
+    LRU_oldest = LRU_newest = NIL;
+    if constexpr (TINY_LFU) {
+      admission.windowOldest = admission.windowNewest = NIL;
+      admission.windowSize = 0;
+    }
+    if constexpr (TIMER_WHEEL) {
+      for (node_t& head : wheel.heads) head = NIL;
+      for (uint64_t& bitmap : wheel.occupied) bitmap = 0;
+    }
+    _size = 0;
+
+    for (const MigratedEntry& entry : entries) {
+      std::size_t index, stopIndex = hashToIndex(entry.hash);
+      if constexpr (ROBIN_HOOD) {
+        //the key is not in the table yet, so the search stops where it should be inserted
+        findKey(migratedKey(entry), entry.hash, stopIndex);
+        index = stopIndex;
+        makeRoomAt(index);
+      } else {
+        index = nextEmpty(stopIndex);
+      }
+      table[index].kv = entry.kv;
+      if constexpr (not INLINE) table[index].hash = entry.hash;
+      setExpireTime(index, entry.expireTime);
+      if constexpr (CONTROL) setControl(index, controlTag(entry.hash));
+      if constexpr (CLOCK) referenced[index] = entry.referenced;
+      else {
+        LRU_insertNewest(nodeAt(index));
+        if constexpr (TINY_LFU) {
+          if (kvAt(index).inWindow) admission.windowSize++;
+        }
+      }
+      if constexpr (TIMER_WHEEL) wheelAdd(nodeAt(index), expireTimeAt(index));
+      _size++;
+    }
+  }
 
-      std::vector<std::size_t> sample;
-      sample.reserve(MIN_SAMPLE_SIZE+5);
-      while (sample.size() < MIN_SAMPLE_SIZE) {
-        std::size_t index = randomIndex();
-        while (isEmpty(index)) index = randomIndex();
+  inline const Key& migratedKey(const MigratedEntry& entry) const {
+    if constexpr (INLINE) return entry.kv.key;
+    else return entry.kv->key;
+  }
 
-        bool alreadySampled = std::find(sample.begin(), sample.end(), index) != sample.end();
-        if (alreadySampled) continue;
+  /*** snapshots (save and load) ***/
 
-        std::vector<std::size_t> cluster = clusterIndices(index);
-        std::move(cluster.begin(), cluster.end(), std::back_inserter(sample));
-        fixCluster(index); //this removes the expired entries in the cluster, updating _size in the process
-      }
+  static constexpr char SNAPSHOT_MAGIC[8] = {'T', 'T', 'L', 'C', 'A', 'C', 'H', 'E'};
+  static constexpr uint32_t SNAPSHOT_VERSION = 1;
+  //each record starts with the remaining ttl and the sizes of the key and the value
+  static constexpr std::size_t SNAPSHOT_RECORD_HEADER = sizeof(timestamp_t) + 2 * sizeof(uint32_t);
 
-      unsigned int expiredCount = (beforeSize - _size);
-      expiredRatio = expiredCount / (double) sample.size(); 
+  struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t timestampSize;
+    uint64_t count;
+  };
 
+  /*** bulk insertion (bulk_load, and load of snapshots) ***/
 
-      if (VERBOSE) std::cerr<<"sampled "<<sample.size()<<" random keys, removed "<<expiredCount
-                            <<" expired keys ("<<100.0*expiredRatio<<"%)"<<std::endl;
-      if (expiredRatio <= targetRatio) break;
+  /* inserts a pair into a cache that does not have expired entries (it was empty at the current time),
+     and that has room for it (see bulk_load), without fixing clusters: the pair goes where a rebuild of
+     the table would put it. a key that is already cached is just updated, through the regular insertion
+  */
+  template<class LookupKey, class V>
+  void placeEntry(LookupKey&& key, const std::size_t hash, const timestamp_t ttl, V&& value) {
+    std::size_t stopIndex = hashToIndex(hash);
+    if (findKey(key, hash, stopIndex) != invalidIndex()) {
+      insertHashed(std::forward<LookupKey>(key), hash, ttl, true, std::forward<V>(value));
+      return;
     }
-
-    if (VERBOSE) std::cerr<<"EXPIRE result: size: "<<_size<<", load factor: "<<loadFactor()
-                          <<", last sample expired ratio: "<<100.0*expiredRatio<<"%"<<std::endl<<std::endl;
+    assert(_size < _tableMaxSize);
+    if constexpr (TINY_LFU) admission.sketch.record(hash);
+    std::size_t index;
+    if constexpr (ROBIN_HOOD) {
+      //the key is not in the table, so the search stopped where it should be inserted
+      index = stopIndex;
+      makeRoomAt(index);
+    } else {
+      index = nextEmpty(hashToIndex(hash));
+    }
+    setEntry(index, hash, currentTime + ttl, std::forward<LookupKey>(key), std::forward<V>(value));
+    if constexpr (TIMER_WHEEL) wheelAdd(nodeAt(index), expireTimeAt(index));
+    markInserted(index);
+    _size++;
+    if constexpr (STATS) _stats.inserts++;
+    if constexpr (WEIGHTED) weighPair(index);
   }
 
+  /*** allocation of the table arrays: the table, the CLOCK reference bits, and the CONTROL_BYTES ***/
+
+  //with RELATIVE_POINTERS, they are placed one after the other at 'arrays'. otherwise, on the heap
+  void allocateArrays(char* arrays) {
+    if constexpr (RELATIVE) {
+      TableEntry* entries = reinterpret_cast<TableEntry*>(arrays);
+      for (std::size_t i = 0; i < _capacity; i++) new (&entries[i]) TableEntry();
+      table = entries;
+      arrays += _capacity * sizeof(TableEntry);
+      if constexpr (CLOCK) {
+        std::memset(arrays, 0, _capacity);
+        referenced = reinterpret_cast<uint8_t*>(arrays);
+        arrays += _capacity;
+      }
+      if constexpr (CONTROL) {
+        control = reinterpret_cast<uint8_t*>(arrays);
+        std::memset(control, EMPTY_CONTROL, controlSize(_capacity));
+      }
+    } else {
+      table = new TableEntry[_capacity];
+      if constexpr (CLOCK) referenced = new uint8_t[_capacity]();
+      if constexpr (CONTROL) {
+        control = new uint8_t[controlSize(_capacity)];
+        std::memset(control, EMPTY_CONTROL, controlSize(_capacity));
+      }
+    }
+  }
 
-  void print() const {
-    std::cout<<"State [at time "<<currentTime<<"]"<<std::endl<<std::endl;
-    printTable();
-    std::cout<<std::endl<<"LRU order: "<<std::endl;
-    printLRUOrder();
-    std::cout<<std::endl;
+  void freeArrays() {
+    if constexpr (not RELATIVE) {
+      delete[] table;
+      delete[] referenced;
+      delete[] control;
+    }
   }
 
-  std::vector<Key> LRU_order() {
-    std::vector<Key> res;
-    res.reserve(_size);
-    KeyValue* cur = LRU_oldest;
-    while (cur) {
-      res.push_back(cur->key);
-      cur = cur->next;
-    }    
-    return res;
+  static constexpr std::size_t arraysSize(const std::size_t capacity) {
+    return capacity * sizeof(TableEntry) + (CLOCK ? capacity : 0) + (CONTROL ? controlSize(capacity) : 0);
   }
 
+  /*** batching functions ***/
 
+  static constexpr unsigned int BATCH_SIZE = 16; //keys with outstanding prefetches at the same time
+  static constexpr std::size_t MIN_HASHES_PER_THREAD = 10000; //for bulk_load, so the threads are worth starting
 
+  static inline void prefetch(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#else
+    (void) address;
+#endif
+  }
 
-private:
+  /* hashes up to BATCH_SIZE keys starting at 'first' (advancing it), and prefetches their ideal
+     table entries and then, once those are (hopefully) loaded, the KeyValue nodes they point to.
+     'getKey' extracts the key from an element of the range. returns the number of keys in the group
+  */
+  template<class Iterator, class GetKey>
+  unsigned int prefetchGroup(Iterator& first, const Iterator last, std::size_t* hashes, const GetKey& getKey) const {
+    unsigned int groupSize = 0;
+    for (; groupSize < BATCH_SIZE and first != last; groupSize++, ++first) {
+      hashes[groupSize] = hashKey(getKey(*first));
+      prefetch(&table[hashToIndex(hashes[groupSize])]);
+    }
+    if constexpr (not INLINE) {
+      for (unsigned int i = 0; i < groupSize; i++) {
+        const KeyValue* kv = table[hashToIndex(hashes[i])].kv;
+        if (kv != nullptr) prefetch(kv);
+      }
+    }
+    return groupSize;
+  }
 
-  inline std::size_t nextIndex(const std::size_t index) const {
-    return (index + 1)%_capacity;
+  //with COMPACT_ENTRIES, the hashes are folded to 32 bits everywhere, so that they match the stored ones
+  template<class LookupKey>
+  inline std::size_t hashKey(const LookupKey& key) const {
+    std::size_t hash = hashFunction(key);
+    if constexpr (MIXED) hash = mixHash(hash ^ hashSeed);
+    if constexpr (COMPACT) hash = (uint32_t) (static_cast<uint64_t>(hash) ^ (static_cast<uint64_t>(hash) >> 32));
+    return hash;
   }
 
-  inline std::size_t prevIndex(const std::size_t index) const {
-    return (index + _capacity - 1)%_capacity;
+  //finalizer of MurmurHash3: every input bit affects every output bit
+  static inline std::size_t mixHash(const std::size_t hash) {
+    uint64_t h = hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return (std::size_t) h;
   }
 
-  inline std::size_t invalidIndex() const {
-    return _capacity; //arbitrary value outside the valid range
+  /*** storage functions: the only ones that depend on where the key-value pairs live ***/
+
+  inline KeyValue& kvOf(const node_t node) const {
+    if constexpr (INLINE) return table[node].kv;
+    else return *node;
   }
 
-  inline std::size_t randomIndex() {
-    return (std::size_t) RNG()%_capacity;
+  //precondition: table is not empty at index
+  inline node_t nodeAt(const std::size_t index) const {
+    if constexpr (INLINE) return (node_t) index;
+    else return table[index].kv;
   }
 
-  inline std::size_t hashToIndex(const std::size_t hash) const {
-    return hash % _capacity;
+  //precondition: table is not empty at index
+  inline KeyValue& kvAt(const std::size_t index) const {
+    return kvOf(nodeAt(index));
   }
 
-  inline std::size_t entryDist(const std::size_t index1, const std::size_t index2) const {
-    if (index1 <= index2) return index2 - index1;
-    return index2 + _capacity - index1;
+  //precondition: table is not empty at index
+  inline std::size_t hashAt(const std::size_t index) const {
+    if constexpr (INLINE) return hashKey(table[index].kv.key);
+    else return table[index].hash;
   }
 
-  inline std::size_t entryIndex(const TableEntry* entry) const {
-    return (entry - &table)/sizeof(TableEntry);
+  //the index of the table entry with this node. for pointers, this requires a search
+  inline std::size_t indexOf(const node_t node) const {
+    if constexpr (INLINE) return node;
+    else return findKey(node->key);
   }
 
   inline bool isEmpty(const std::size_t index) const {
-    return table[index].kv == nullptr;
+    if constexpr (CONTROL) return control[index] == EMPTY_CONTROL;
+    else if constexpr (INLINE) return table[index].expireTime == EMPTY_FLAG;
+    else return table[index].kv == nullptr;
   }
 
-  inline void setEmpty(const std::size_t index) const {
-    table[index].kv = nullptr; //lazy operation: does not update the other fields
+  inline void setEmpty(const std::size_t index) {
+    //lazy operation: does not update the other fields
+    if constexpr (INLINE) table[index].expireTime = EMPTY_FLAG;
+    else table[index].kv = nullptr;
+    if constexpr (CONTROL) setControl(index, EMPTY_CONTROL);
   }
 
-  inline void moveEntryFromTo(const std::size_t fromIndex, const std::size_t toIndex) const {
-      table[toIndex].kv = table[fromIndex].kv;
-      table[toIndex].hash = table[fromIndex].hash;
-      table[toIndex].expireTime = table[fromIndex].expireTime;
+  //precondition: table is empty at index. does not add the entry to the LRU list
+  template<class LookupKey, class... ValueArgs>
+  void setEntry(const std::size_t index, const std::size_t hash, const timestamp_t expireTime,
+                LookupKey&& key, ValueArgs&&... valueArgs) {
+    assert(isEmpty(index));
+    if constexpr (INLINE) {
+      table[index].kv = KeyValue(std::piecewise_construct, std::forward<LookupKey>(key),
+                                 std::forward<ValueArgs>(valueArgs)...);
+    } else {
+      table[index].kv = pool.create(std::piecewise_construct, std::forward<LookupKey>(key),
+                                    std::forward<ValueArgs>(valueArgs)...);
+      table[index].hash = hash;
+    }
+    setExpireTime(index, expireTime);
+    if constexpr (CONTROL) setControl(index, controlTag(hash));
+  }
+
+  //with inline storage, the LRU list links pointing to the moved entry are updated
+  inline void moveEntryFromTo(const std::size_t fromIndex, const std::size_t toIndex) {
+      if constexpr (STATS) _stats.relocations++;
+      table[toIndex] = table[fromIndex];
+      if constexpr (CONTROL) setControl(toIndex, control[fromIndex]);
       setEmpty(fromIndex);
+      if constexpr (CLOCK) referenced[toIndex] = referenced[fromIndex];
+      if constexpr (INLINE) {
+        KeyValue& kv = table[toIndex].kv;
+        if constexpr (not CLOCK) {
+          if (kv.prev != NIL) kvOf(kv.prev).next = toIndex;
+          else LRU_oldestOf(toIndex) = toIndex;
+          if (kv.next != NIL) kvOf(kv.next).prev = toIndex;
+          else LRU_newestOf(toIndex) = toIndex;
+        }
+        if constexpr (TIMER_WHEEL) {
+          if (kv.wheelPrev != NIL) kvOf(kv.wheelPrev).wheelNext = toIndex;
+          else wheel.heads[kv.wheelBucket] = toIndex;
+          if (kv.wheelNext != NIL) kvOf(kv.wheelNext).wheelPrev = toIndex;
+        }
+      }
   }
 
   std::size_t nextEmpty(std::size_t index) const {
@@ -363,29 +2149,67 @@ private:
     return index;
   }
 
-  inline std::size_t clusterSize(const std::size_t index) const {
-    assert (not isEmpty(index));
-    return nextEmpty(index) - findClusterStart(index);
+  inline bool isInSampledCluster(const std::size_t index, const unsigned int numSampledClusters) const {
+    for (unsigned int i = 0; i < numSampledClusters; i++) {
+      if (entryDist(sampledClusters[i].first, index) < sampledClusters[i].second) return true;
+    }
+    return false;
   }
 
-  std::vector<std::size_t> clusterIndices(std::size_t index) const {
+  inline bool isExpired(const std::size_t index) const {
     assert(not isEmpty(index));
-    std::vector<std::size_t> res;
-    while (not isEmpty(index)) { //add indices after
-      res.push_back(index);
-      index = nextIndex(index);
-    }
-    index = prevIndex(res[0]);
-    while (not isEmpty(index)) { //add indices before
-      res.push_back(index);
-      index = prevIndex(index);
+    return currentTime >= expireTimeAt(index);
+  }
+
+  /*** expire times: stored as they are, or as 32-bit ticks after the epoch with COMPACT_ENTRIES ***/
+
+  static constexpr long long MAX_EXPIRE_OFFSET = (long long) UINT32_MAX - 1; //UINT32_MAX is EMPTY_FLAG
+
+  //precondition: table is not empty at index
+  inline timestamp_t expireTimeAt(const std::size_t index) const {
+    if constexpr (COMPACT) return decodeExpireTime(table[index].expireTime);
+    else return table[index].expireTime;
+  }
+
+  //precondition: table is not empty at index. with COMPACT_ENTRIES, the time is rounded up to a whole tick
+  inline void setExpireTime(const std::size_t index, const timestamp_t expireTime) {
+    if constexpr (COMPACT) table[index].expireTime = encodeExpireTime(expireTime);
+    else table[index].expireTime = expireTime;
+  }
+
+  inline timestamp_t decodeExpireTime(const expire_t stored) const {
+    long long tick = expireEpoch + (long long) stored - 1;
+    if constexpr (std::is_integral<timestamp_t>::value) return (timestamp_t) (tick * (timestamp_t) Options::COMPACT_RESOLUTION);
+    else return (timestamp_t) (tick * Options::COMPACT_RESOLUTION);
+  }
+
+  /* moves the epoch to the current tick if it is more than half the range behind, which keeps
+     the range for ttls of at least 2^31 ticks. longer ones are capped
+  */
+  expire_t encodeExpireTime(const timestamp_t expireTime) {
+    long long tick, currentTick;
+    if constexpr (std::is_integral<timestamp_t>::value) {
+      const timestamp_t resolution = (timestamp_t) Options::COMPACT_RESOLUTION;
+      tick = (long long) ((expireTime + resolution - 1) / resolution);
+      currentTick = (long long) (currentTime / resolution);
+    } else {
+      tick = (long long) std::ceil(expireTime / Options::COMPACT_RESOLUTION);
+      currentTick = (long long) std::floor(currentTime / Options::COMPACT_RESOLUTION);
     }
-    return res;
+    if (currentTick - expireEpoch > MAX_EXPIRE_OFFSET / 2) moveExpireEpoch(currentTick);
+    return (expire_t) std::max(1ll, std::min(tick - expireEpoch + 1, MAX_EXPIRE_OFFSET));
   }
 
-  inline bool isExpired(const std::size_t index) const {
-    assert(not isEmpty(index));
-    return currentTime >= table[index].expireTime;
+  //rewrites the stored expire times relative to the new epoch. the ones before it stay expired
+  void moveExpireEpoch(const long long newEpoch) {
+    if (VERBOSE) std::cerr<<"COMPACT: moved the epoch from tick "<<expireEpoch<<" to "<<newEpoch<<std::endl;
+    const long long delta = newEpoch - expireEpoch;
+    for (std::size_t i = 0; i < _capacity; i++) {
+      if (isEmpty(i)) continue;
+      expire_t& stored = table[i].expireTime;
+      stored = (expire_t) std::max(1ll, (long long) stored - delta);
+    }
+    expireEpoch = newEpoch;
   }
 
   /* eager evaluation is used to avoid the potentially expensive key comparison
@@ -393,20 +2217,207 @@ private:
     the key's hash is passed along with the key to avoid recomputing it
     precondition: table is not empty at index
   */
-  inline bool isKeyAtIndex(const Key& key, const std::size_t keyHash, const std::size_t index) const {
+  template<class LookupKey>
+  inline bool isKeyAtIndex(const LookupKey& key, const std::size_t keyHash, const std::size_t index) const {
     assert(not isEmpty(index)); 
-    return table[index].hash == keyHash and table[index].kv->key == key;
+    if constexpr (INLINE) return table[index].kv.key == key;
+    else return table[index].hash == keyHash and table[index].kv->key == key;
+  }
+
+  /* the key's hash is passed along with the key to avoid recomputing it
+     if the key is not found, 'stopIndex' is set to the entry where the search stopped */
+  template<class LookupKey>
+  std::size_t findKey(const LookupKey& key, const std::size_t keyHash, std::size_t& stopIndex) const {
+    if constexpr (CONTROL and not ROBIN_HOOD) return findKeyByGroups(key, keyHash, stopIndex);
+    std::size_t dist = 0;
+    auto idx = hashToIndex(keyHash);
+    for (; not isEmpty(idx); idx = nextIndex(idx), dist++) {
+      if (ROBIN_HOOD and probeDist(idx) < dist) break; //the key would have been placed before
+      if (isKeyAtIndex(key, keyHash, idx)) return idx;
+    }
+    stopIndex = idx;
+    return invalidIndex();
+  }
+  template<class LookupKey>
+  inline std::size_t findKey(const LookupKey& key, const std::size_t keyHash) const {
+    std::size_t stopIndex;
+    return findKey(key, keyHash, stopIndex);
+  }
+  template<class LookupKey>
+  inline std::size_t findKey(const LookupKey& key) const {
+    return findKey(key, hashKey(key));
+  }
+
+  /*** control bytes functions (CONTROL_BYTES) ***/
+
+  static constexpr std::size_t controlSize(const std::size_t capacity) { return capacity + CONTROL_GROUP - 1; }
+
+  //7 bits of the hash, other than the ones used for the position (the multiplication mixes them)
+  static inline uint8_t controlTag(const std::size_t hash) {
+    return (uint8_t) ((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> 57);
+  }
+
+  //also updates the copies of the control byte after the end of the table
+  inline void setControl(const std::size_t index, const uint8_t value) {
+    control[index] = value;
+    for (std::size_t copy = index + _capacity; copy < _capacity + CONTROL_GROUP - 1; copy += _capacity) {
+      control[copy] = value;
+    }
+  }
+
+  //bit i of the result is set if the control byte at index+i is 'value'
+  inline uint32_t matchControlGroup(const std::size_t index, const uint8_t value) const {
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(control + index));
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) value)));
+#else
+    uint32_t res = 0;
+    for (unsigned int i = 0; i < CONTROL_GROUP; i++) res |= uint32_t(control[index + i] == value) << i;
+    return res;
+#endif
+  }
+
+  /* findKey for linear probing with control bytes: the cluster of the key is scanned a group at a time,
+     and only the entries before the first empty one whose control byte matches are compared.
+     since a group can extend past the end of the table (through the copies), indices are wrapped
+  */
+  template<class LookupKey>
+  std::size_t findKeyByGroups(const LookupKey& key, const std::size_t keyHash, std::size_t& stopIndex) const {
+    const uint8_t tag = controlTag(keyHash);
+    std::size_t groupStart = hashToIndex(keyHash);
+    while (true) {
+      uint32_t empties = matchControlGroup(groupStart, EMPTY_CONTROL);
+      uint32_t candidates = matchControlGroup(groupStart, tag);
+      if (empties != 0) candidates &= (empties & (~empties + 1)) - 1; //only the ones before the first empty
+      while (candidates != 0) {
+        std::size_t index = wrapIndex(groupStart + lowestBit(candidates));
+        if (isKeyAtIndex(key, keyHash, index)) return index;
+        candidates &= candidates - 1;
+      }
+      if (empties != 0) {
+        stopIndex = wrapIndex(groupStart + lowestBit(empties));
+        return invalidIndex();
+      }
+      groupStart = wrapIndex(groupStart + CONTROL_GROUP);
+    }
+  }
+
+  //the index of a position that may be past the end of the table (by less than CONTROL_GROUP tables)
+  inline std::size_t wrapIndex(std::size_t position) const {
+    while (position >= _capacity) position -= _capacity;
+    return position;
+  }
+
+  //with STATS or PROBE_MONITOR, records a search that examined the entries from idealIndex to lastIndex
+  inline void countProbe(const std::size_t idealIndex, const std::size_t lastIndex) {
+    if constexpr (STATS or PROBE_MONITOR) {
+      std::size_t length = entryDist(idealIndex, lastIndex) + 1;
+      if constexpr (STATS) {
+        _stats.probeSteps += length;
+        _stats.probeLengthHistogram[ttl_cache_stats::histogramBucket(length)]++;
+      }
+      if constexpr (PROBE_MONITOR) monitorProbe(length);
+    }
+  }
+
+  //adds a search to the window of the monitor, and checks the thresholds when the window is complete
+  void monitorProbe(const std::size_t length) {
+    monitor.windowSteps += length;
+    monitor.windowMax = std::max(monitor.windowMax, length);
+    monitor.searchesSinceReseed++;
+    if (++monitor.windowSearches < PROBE_WINDOW) return;
+
+    ttl_cache_probe_report& report = monitor.report;
+    report.averageProbeLength = monitor.windowSteps / (double) PROBE_WINDOW;
+    report.maxProbeLength = monitor.windowMax;
+    if (report.averageProbeLength > Options::PROBE_ALARM_AVERAGE or report.maxProbeLength > Options::PROBE_ALARM_MAX) {
+      report.alarms++;
+      if (VERBOSE) std::cerr<<"PROBE ALARM: average probe length "<<report.averageProbeLength
+                            <<", maximum "<<report.maxProbeLength<<std::endl;
+      if constexpr (REBUILD_ON_ALARM) {
+        if (monitor.searchesSinceReseed >= _size) monitor.reseedPending = true;
+      }
+    }
+    monitor.windowSearches = monitor.windowSteps = monitor.windowMax = 0;
+  }
+
+  /*** Robin Hood functions ***/
+
+  //distance from the ideal position of the entry at index to its actual position
+  //(the same metric that printTable shows as "(+N)")
+  inline std::size_t probeDist(const std::size_t index) const {
+    assert(not isEmpty(index));
+    return entryDist(hashToIndex(hashAt(index)), index);
   }
 
-  //the key's hash is passed along with the key to avoid recomputing it
-  std::size_t findKey(const Key& key, const std::size_t keyHash) const {
-    for (auto idx = hashToIndex(keyHash); not isEmpty(idx); idx = nextIndex(idx)) {
+  /* searches the key with early termination, removing the expired entries on its probing path.
+     if the key is not found, 'stopIndex' is set to where the key should be inserted to keep the
+     cluster sorted by ideal position (after any entries with the same ideal position)
+  */
+  template<class LookupKey>
+  std::size_t probeRemovingExpired(const LookupKey& key, const std::size_t keyHash, std::size_t& stopIndex) {
+    std::size_t idx = hashToIndex(keyHash);
+    std::size_t dist = 0;
+    while (true) {
+      if (isEmpty(idx)) break;
+      if (isExpired(idx)) {
+        removeWithBackwardShift(idx); //the next entry (if any) is shifted into idx
+        continue;
+      }
+      if (probeDist(idx) < dist) break;
       if (isKeyAtIndex(key, keyHash, idx)) return idx;
+      idx = nextIndex(idx);
+      dist++;
     }
+    stopIndex = idx;
     return invalidIndex();
   }
-  inline std::size_t findKey(const Key& key) const {
-    return findKey(key, hashFunction(key));
+
+  //shifts the entries from index up to the next empty one forward by one, leaving index empty
+  void makeRoomAt(const std::size_t index) {
+    std::size_t emptyIndex = nextEmpty(index);
+    while (emptyIndex != index) {
+      std::size_t prev = prevIndex(emptyIndex);
+      moveEntryFromTo(prev, emptyIndex);
+      emptyIndex = prev;
+    }
+  }
+
+  //removes the entry and shifts the following ones back by one, until one is at its ideal position
+  void removeWithBackwardShift(std::size_t index) {
+    if (VERBOSE) logRemoval(index);
+    removeWithoutRelocations(index);
+    std::size_t next = nextIndex(index);
+    while (not isEmpty(next) and probeDist(next) > 0) {
+      moveEntryFromTo(next, index);
+      index = next;
+      next = nextIndex(next);
+    }
+  }
+
+  /* version of fixCluster for Robin Hood probing, in a single pass:
+     the expired entries are removed while the remaining ones are compacted, keeping their order.
+     each entry is moved back to the first free position, but not before its ideal position
+  */
+  void compactCluster(const std::size_t indexInCluster) {
+    if (isEmpty(indexInCluster)) return;
+    std::size_t startIndex = findClusterStart(indexInCluster);
+    std::size_t freeIndex = startIndex; //first position that is free after the entries already processed
+    for (std::size_t index = startIndex; not isEmpty(index); index = nextIndex(index)) {
+      if (isExpired(index)) {
+        if (VERBOSE) logRemoval(index);
+        removeWithoutRelocations(index);
+        continue;
+      }
+      std::size_t idealIndex = hashToIndex(hashAt(index));
+      std::size_t newIdx = entryDist(startIndex, idealIndex) > entryDist(startIndex, freeIndex) ? idealIndex : freeIndex;
+      if (newIdx != index) {
+        moveEntryFromTo(index, newIdx);
+        if (VERBOSE) std::cerr<<"repositioned key "<<kvAt(newIdx).key
+                              <<" from pos "<<index<<" to "<<newIdx<<std::endl;
+      }
+      freeIndex = nextIndex(newIdx);
+    }
   }
 
   /* a cluster is a maximal contiguous sequence of non-empty entries.
@@ -416,6 +2427,10 @@ private:
      by moving them to their best possible location, from left to right
   */
   void fixCluster(const std::size_t indexInCluster) {
+    if constexpr (ROBIN_HOOD) {
+      compactCluster(indexInCluster);
+      return;
+    }
     if (isEmpty(indexInCluster)) return;
 
     //pass 1: remove all expired entries, without relocating anything
@@ -424,13 +2439,7 @@ private:
     std::size_t index = startIndex;
     while (not isEmpty(index)) {
       if (isExpired(index)) {
-        if (VERBOSE) {
-          if (table[index].expireTime != LRU_EVICTED_FLAG) {
-            std::cerr<<"TTL: removed expired key "<<table[index].kv->key
-                     <<" [expired at "<<table[index].expireTime
-                     <<", now is "<<currentTime<<"]"<<std::endl;
-          }
-        }
+        if (VERBOSE) logRemoval(index);
         removeWithoutRelocations(index);
         if (firstRemovedIndex == invalidIndex()) {
           firstRemovedIndex = index;
@@ -449,7 +2458,7 @@ private:
     while (index != clusterEnd) {
       if (not isEmpty(index)) {
         assert(not isExpired(index));
-        std::size_t idealIndex = hashToIndex(table[index].hash);
+        std::size_t idealIndex = hashToIndex(hashAt(index));
         if (idealIndex != index) {
           std::size_t newIdx = idealIndex;
           //possible optimization: instead of initializing newIdx to idealIndex
@@ -458,7 +2467,7 @@ private:
 
           if (newIdx != index) {
             moveEntryFromTo(index, newIdx);
-            if (VERBOSE) std::cerr<<"repositioned key "<<table[newIdx].kv->key
+            if (VERBOSE) std::cerr<<"repositioned key "<<kvAt(newIdx).key
                                   <<" from pos "<<index<<" to "<<newIdx<<std::endl;
           }
         }
@@ -467,90 +2476,399 @@ private:
     }
   }
 
+  void logRemoval(const std::size_t index) const {
+    if (table[index].expireTime != LRU_EVICTED_FLAG) {
+      std::cerr<<"TTL: removed expired key "<<kvAt(index).key
+               <<" [expired at "<<expireTimeAt(index)
+               <<", now is "<<currentTime<<"]"<<std::endl;
+    }
+  }
+
   /* removes from the hash table and the doubly-linked list,
      but does not make relocations to maintain the open-adressing invariant
   */
   void removeWithoutRelocations(const std::size_t index) {
     assert(not isEmpty(index));
-    KeyValue* kv = table[index].kv;
+    if constexpr (NOTIFIED) notifyRemoval(index);
+    if constexpr (STATS) {
+      if (table[index].expireTime == LRU_EVICTED_FLAG) _stats.evictions++;
+      else _stats.expirations++;
+    }
+    if constexpr (not CLOCK) LRU_removeFromList(nodeAt(index));
+    if constexpr (TINY_LFU) {
+      if (kvAt(index).inWindow) admission.windowSize--;
+    }
+    if constexpr (TIMER_WHEEL) wheelRemove(nodeAt(index));
+    if constexpr (WEIGHTED) weights.totalWeight -= kvAt(index).weight;
+    if constexpr (not INLINE) pool.destroy(table[index].kv);
     setEmpty(index);
-    LRU_removeFromList(kv);
     _size--;
-    delete kv;
+  }
+
+  void notifyRemoval(const std::size_t index) {
+    KeyValue& kv = kvAt(index);
+    if (table[index].expireTime == LRU_EVICTED_FLAG) {
+      removals.listener(static_cast<const Key&>(kv.key), kv.value, removals.evictedExpireTime, removals.evictionCause);
+    } else {
+      removals.listener(static_cast<const Key&>(kv.key), kv.value, expireTimeAt(index), ttl_cache_removal_cause::expired);
+    }
+  }
+
+
+
+  /*** eviction policy: the LRU list, or CLOCK with CLOCK_EVICTION ***/
+
+  //for the reference bits set by peek, which may run concurrently with other peeks
+  template<class T>
+  static inline void storeRelaxed(T& location, const T value) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&location, value, __ATOMIC_RELAXED);
+#else
+    location = value;
+#endif
+  }
+
+  //for a hit or an update of the entry at index
+  inline void markAccessed(const std::size_t index) {
+    if constexpr (CLOCK) referenced[index] = 1;
+    else LRU_moveToNewest(nodeAt(index));
+  }
+
+  /* for a new entry at index. with CLOCK, it has to be used again before the hand reaches it to stay.
+     with TINY_LFU, it enters the window, and if the window overflows (which can only happen if the cache
+     is not full, see TINY_LFU_evict), the oldest pair of the window moves to the main list
+  */
+  inline void markInserted(const std::size_t index) {
+    if constexpr (CLOCK) {
+      referenced[index] = 0;
+    } else if constexpr (TINY_LFU) {
+      kvAt(index).inWindow = true;
+      LRU_insertNewest(nodeAt(index));
+      admission.windowSize++;
+      if (admission.windowSize > admission.windowMaxSize) TINY_LFU_moveToMain(admission.windowOldest);
+    } else {
+      LRU_insertNewest(nodeAt(index));
+    }
+  }
+
+  inline void evictOne() {
+    if constexpr (CLOCK) CLOCK_evict();
+    else if constexpr (TINY_LFU) TINY_LFU_evict();
+    else LRU_evictOldest();
+  }
+
+  /* removes a pair that may still be alive ('cause' is evicted or erased): its expire time is replaced by
+     a flag that makes it look expired, so that the removal of expired entries takes it out
+  */
+  void evictAt(const std::size_t index, const ttl_cache_removal_cause cause) {
+    if constexpr (NOTIFIED) {
+      removals.evictedExpireTime = expireTimeAt(index);
+      removals.evictionCause = cause;
+    } else {
+      (void) cause;
+    }
+    table[index].expireTime = LRU_EVICTED_FLAG;
+    if constexpr (ROBIN_HOOD) removeWithBackwardShift(index);
+    else fixCluster(index);
+  }
+
+  /* advances the hand to the first entry that is expired or not referenced, clearing the reference
+     bits on its way, and evicts it. this takes at most one full turn of the table after clearing the bits
+  */
+  void CLOCK_evict() {
+    assert(_size > 0);
+    while (true) {
+      clockHand = nextIndex(clockHand);
+      if (isEmpty(clockHand)) continue;
+      if (isExpired(clockHand)) break;
+      if (not referenced[clockHand]) break;
+      referenced[clockHand] = 0;
+    }
+
+    if (VERBOSE) std::cerr<<"CLOCK: evicted key "<<kvAt(clockHand).key
+                          <<" from pos "<<clockHand<<std::endl;
+
+    if (isExpired(clockHand)) removeExpiredEntry(clockHand);
+    else evictAt(clockHand, ttl_cache_removal_cause::evicted);
+  }
+
+
+
+  /*** TinyLFU functions ***/
+
+  /* makes room for a new pair in the window of a full cache.
+     if the window is not full, the main list is over its share, so its LRU pair is evicted.
+     otherwise, the oldest pair of the window (the candidate) either replaces the LRU pair of the main list
+     (the victim), if it was accessed more frequently, or is evicted. an expired victim is always removed
+  */
+  void TINY_LFU_evict() {
+    //with WEIGHER, the cache can be full while all its pairs are in the window
+    if (admission.windowSize < admission.windowMaxSize and LRU_oldest != NIL) {
+      LRU_evictOldest();
+      return;
+    }
+    node_t candidate = admission.windowOldest;
+    node_t victim = LRU_oldest;
+    //an expired victim is taken without a duel, and the candidate stays in the window
+    if (victim != NIL and isExpired(indexOf(victim))) {
+      LRU_evict(victim);
+      return;
+    }
+    if (victim != NIL and estimatedFrequency(candidate) > estimatedFrequency(victim)) {
+      //the candidate is moved before the eviction, because with inline storage, the relocations
+      //of the eviction can change its node
+      TINY_LFU_moveToMain(candidate);
+      LRU_evict(victim);
+    } else {
+      if constexpr (STATS) _stats.admissionRejections++;
+      if (VERBOSE) std::cerr<<"TinyLFU: rejected key "<<kvOf(candidate).key<<" from the main list"<<std::endl;
+      LRU_evict(candidate);
+    }
+  }
+
+  //moves a pair from the window to the newest end of the main list
+  void TINY_LFU_moveToMain(const node_t node) {
+    assert(kvOf(node).inWindow);
+    LRU_removeFromList(node);
+    admission.windowSize--;
+    kvOf(node).inWindow = false;
+    LRU_insertNewest(node);
+  }
+
+  inline unsigned int estimatedFrequency(const node_t node) const {
+    return admission.sketch.estimate(hashAt(indexOf(node)));
   }
 
 
 
   /*** LRU functions ***/
 
+  //the ends of the list containing the node: with TINY_LFU, it can be the window list
+  inline node_t& LRU_oldestOf(const node_t node) {
+    if constexpr (TINY_LFU) {
+      if (kvOf(node).inWindow) return admission.windowOldest;
+    }
+    return LRU_oldest;
+  }
+  inline node_t& LRU_newestOf(const node_t node) {
+    if constexpr (TINY_LFU) {
+      if (kvOf(node).inWindow) return admission.windowNewest;
+    }
+    return LRU_newest;
+  }
+
 
-  //updates the next/prev pointers, and LRU_newest/LRU_oldest, as needed
-  //so that the LRU list is exactly the same but without 'kv'
-  //- does not update _size nor delete kv
-  //- the next/prev pointers of kv are not set to null
-  void LRU_removeFromList(const KeyValue* kv) {
-    if (_size == 1) {
-      assert(kv == LRU_newest);
-      assert(kv == LRU_oldest);
-      LRU_newest = LRU_oldest = nullptr;
-    } else if (kv == LRU_newest) {
-      assert(kv != LRU_oldest);
-      LRU_newest = LRU_newest->prev;
-      LRU_newest->next = nullptr;
-    } else if (kv == LRU_oldest) {
-      assert (kv != LRU_newest);
-      LRU_oldest = LRU_oldest->next;
-      LRU_oldest->prev = nullptr;
+  //updates the next/prev links, and LRU_newest/LRU_oldest, as needed
+  //so that the LRU list is exactly the same but without 'node'
+  //- does not update _size nor delete the node
+  //- the next/prev links of the node are not reset
+  void LRU_removeFromList(const node_t node) {
+    KeyValue& kv = kvOf(node);
+    node_t& oldest = LRU_oldestOf(node);
+    node_t& newest = LRU_newestOf(node);
+    if (node == newest and node == oldest) {
+      newest = oldest = NIL;
+    } else if (node == newest) {
+      newest = kv.prev;
+      kvOf(newest).next = NIL;
+    } else if (node == oldest) {
+      oldest = kv.next;
+      kvOf(oldest).prev = NIL;
     } else {
-      kv->next->prev = kv->prev;
-      kv->prev->next = kv->next;
+      kvOf(kv.next).prev = kv.prev;
+      kvOf(kv.prev).next = kv.next;
     }
   }
 
-  void LRU_moveToNewest(KeyValue* kv) {
-    if (kv == LRU_newest) {
-      if (VERBOSE) std::cerr<<"LRU: moved key "<<kv->key
+  void LRU_moveToNewest(const node_t node) {
+    if (node == LRU_newestOf(node)) {
+      if (VERBOSE) std::cerr<<"LRU: moved key "<<kvOf(node).key
                             <<" to the end of the LRU order: already there"<<std::endl;
       return;
     }
-    LRU_removeFromList(kv);
-    LRU_insertNewest(kv, true);
-    assert(findKey(kv->key) != invalidIndex());
+    LRU_removeFromList(node);
+    LRU_insertNewest(node, true);
+    assert(findKey(kvOf(node).key) != invalidIndex());
   }
 
-  //updates the next/prev pointers, and LRU_newest/LRU_oldest, as needed
-  //so that the LRU list is exactly the same but with 'kv' at the end
+  //updates the next/prev links, and LRU_newest/LRU_oldest, as needed
+  //so that the LRU list is exactly the same but with 'node' at the end
   //- does not update _size
   //- the optional bool parameter is only relevant for logging in verbose mode
-  void LRU_insertNewest(KeyValue* kv, const bool logAsMove = false) {
-    if (_size == 0) {
-      LRU_oldest = LRU_newest = kv;
-      kv->next = kv->prev = nullptr;
+  void LRU_insertNewest(const node_t node, const bool logAsMove = false) {
+    KeyValue& kv = kvOf(node);
+    node_t& oldest = LRU_oldestOf(node);
+    node_t& newest = LRU_newestOf(node);
+    if (newest == NIL) {
+      oldest = newest = node;
+      kv.next = kv.prev = NIL;
     }
     else  {
-      LRU_newest->next = kv;
-      kv->prev = LRU_newest;
-      kv->next= nullptr;
-      LRU_newest = kv;
+      kvOf(newest).next = node;
+      kv.prev = newest;
+      kv.next = NIL;
+      newest = node;
     }
     if (VERBOSE) {
-      if (logAsMove) std::cerr<<"LRU: moved key "<<kv->key<<" to the end of the LRU order"<<std::endl;
-      else           std::cerr<<"LRU: added key "<<kv->key<<" at the end of the LRU order"<<std::endl;
+      if (logAsMove) std::cerr<<"LRU: moved key "<<kv.key<<" to the end of the LRU order"<<std::endl;
+      else           std::cerr<<"LRU: added key "<<kv.key<<" at the end of the LRU order"<<std::endl;
     }
   }
 
   void LRU_evictOldest() {
+    LRU_evict(LRU_oldest);
+  }
+
+  void LRU_evict(const node_t node) {
     assert(_size > 0);
-    std::size_t index = findKey(LRU_oldest->key);
+    std::size_t index = indexOf(node);
     assert(index != invalidIndex());
 
-    //manipulate the expire time to make it look expired
-    table[index].expireTime = LRU_EVICTED_FLAG;
+    //an expired pair is removed as such, so that it is not counted (nor notified) as an eviction
+    if (isExpired(index)) {
+      removeExpiredEntry(index);
+      return;
+    }
 
-    if (VERBOSE) std::cerr<<"LRU: evicted key "<<LRU_oldest->key
+    if (VERBOSE) std::cerr<<"LRU: evicted key "<<kvOf(node).key
                           <<" from pos "<<index<<std::endl;
 
-    fixCluster(index);
+    evictAt(index, ttl_cache_removal_cause::evicted);
+  }
+
+
+
+  /*** timing wheel functions ***/
+
+  static long long wheelTick(const timestamp_t time) {
+    if constexpr (std::is_integral<timestamp_t>::value) {
+      return (long long) (time / (timestamp_t) Options::TIMER_WHEEL_RESOLUTION);
+    } else {
+      return (long long) std::floor(time / Options::TIMER_WHEEL_RESOLUTION);
+    }
+  }
+
+  inline void wheelLink(const node_t node, const unsigned int bucket) {
+    KeyValue& kv = kvOf(node);
+    kv.wheelBucket = (uint16_t) bucket;
+    kv.wheelPrev = NIL;
+    kv.wheelNext = wheel.heads[bucket];
+    if (kv.wheelNext != NIL) kvOf(kv.wheelNext).wheelPrev = node;
+    wheel.heads[bucket] = node;
+    if (bucket != WHEEL_SCRATCH_BUCKET) wheel.occupied[bucket / WHEEL_SLOTS] |= uint64_t(1) << (bucket % WHEEL_SLOTS);
+  }
+
+  //precondition: the node is in the wheel
+  inline void wheelRemove(const node_t node) {
+    KeyValue& kv = kvOf(node);
+    if (kv.wheelNext != NIL) kvOf(kv.wheelNext).wheelPrev = kv.wheelPrev;
+    if (kv.wheelPrev != NIL) {
+      kvOf(kv.wheelPrev).wheelNext = kv.wheelNext;
+    } else {
+      wheel.heads[kv.wheelBucket] = kv.wheelNext;
+      if (kv.wheelNext == NIL and kv.wheelBucket != WHEEL_SCRATCH_BUCKET) {
+        wheel.occupied[kv.wheelBucket / WHEEL_SLOTS] &= ~(uint64_t(1) << (kv.wheelBucket % WHEEL_SLOTS));
+      }
+    }
+  }
+
+  //adds the node to the bucket corresponding to its expire time. the node must not be in the wheel
+  void wheelAdd(const node_t node, const timestamp_t expireTime) {
+    long long tick = std::max(wheelTick(expireTime), wheel.time);
+    unsigned int level = 0;
+    while (level < WHEEL_LEVELS-1 and
+           (tick >> (WHEEL_BITS*(level+1))) != (wheel.time >> (WHEEL_BITS*(level+1)))) level++;
+    unsigned int slot = (tick >> (WHEEL_BITS*level)) & (WHEEL_SLOTS-1);
+    wheelLink(node, level*WHEEL_SLOTS + slot);
+  }
+
+  //first tick, not before the wheel's time, at which a bucket of level 0 expires or a bucket of a higher
+  //level must be cascaded. returns -1 if the wheel is empty
+  long long wheelNextEvent() const {
+    long long res = -1;
+    for (unsigned int level = 0; level < WHEEL_LEVELS; level++) {
+      unsigned int shift = WHEEL_BITS*level;
+      unsigned int digit = (wheel.time >> shift) & (WHEEL_SLOTS-1);
+      uint64_t buckets = wheel.occupied[level] & (~uint64_t(0) << digit); //there are none before 'digit'
+      if (buckets == 0) continue;
+      long long slot = lowestBit(buckets);
+      long long blockStart = level == WHEEL_LEVELS-1 ? 0 : (wheel.time >> (shift+WHEEL_BITS)) << (shift+WHEEL_BITS);
+      long long tick = std::max(blockStart + (slot << shift), wheel.time);
+      if (res == -1 or tick < res) res = tick;
+    }
+    return res;
+  }
+
+  static inline unsigned int lowestBit(const uint64_t bits) {
+    unsigned int res = 0;
+    while (((bits >> res) & 1) == 0) res++; //a loop instead of a compiler intrinsic, for portability
+    return res;
+  }
+
+  //redistributes the buckets of levels > 0 that start at the wheel's time, from the highest level down
+  void wheelCascade() {
+    for (unsigned int level = WHEEL_LEVELS-1; level > 0; level--) {
+      unsigned int slot = (wheel.time >> (WHEEL_BITS*level)) & (WHEEL_SLOTS-1);
+      unsigned int bucket = level*WHEEL_SLOTS + slot;
+      while (wheel.heads[bucket] != NIL) {
+        node_t node = wheel.heads[bucket];
+        wheelRemove(node);
+        wheelAdd(node, expireTimeAt(indexOf(node)));
+      }
+    }
+  }
+
+  /* moves the wheel's time to 'tick', removing all the entries that expire before it.
+     the entries that expire at 'tick' itself may or may not be expired, so they are checked one by one
+     removals may relocate entries (and, with inline storage, change their nodes), so the buckets are
+     always processed from their head.
+     after 'maxRemoved' removals, it stops with the wheel's time at the bucket it was processing
+     (possibly behind the current time, which the buckets do not depend on), and returns false
+  */
+  bool wheelAdvance(const long long tick, const std::size_t maxRemoved) {
+    const std::size_t beforeSize = _size;
+    while (true) {
+      long long next = wheelNextEvent();
+      if (next == -1 or next > tick) break;
+      if (beforeSize - _size >= maxRemoved) return false;
+      wheel.time = next;
+      wheelCascade();
+      unsigned int bucket = wheel.time & (WHEEL_SLOTS-1);
+      if (wheel.time < tick) {
+        while (wheel.heads[bucket] != NIL) {
+          if (beforeSize - _size >= maxRemoved) return false;
+          assert(isExpired(indexOf(wheel.heads[bucket])));
+          removeExpiredEntry(indexOf(wheel.heads[bucket]));
+        }
+        wheel.time++;
+      } else {
+        while (wheel.heads[bucket] != NIL) {
+          node_t node = wheel.heads[bucket];
+          std::size_t index = indexOf(node);
+          if (isExpired(index)) {
+            removeExpiredEntry(index);
+          } else {
+            wheelRemove(node);
+            wheelLink(node, WHEEL_SCRATCH_BUCKET);
+          }
+        }
+        while (wheel.heads[WHEEL_SCRATCH_BUCKET] != NIL) {
+          node_t node = wheel.heads[WHEEL_SCRATCH_BUCKET];
+          wheelRemove(node);
+          wheelLink(node, bucket);
+        }
+        break;
+      }
+    }
+    wheel.time = std::max(wheel.time, tick);
+    return true;
+  }
+
+  //removes an expired entry (found through the wheel, or by the eviction policy), also removing any other expired entries in its way
+  void removeExpiredEntry(const std::size_t index) {
+    assert(isExpired(index));
+    if constexpr (ROBIN_HOOD) removeWithBackwardShift(index);
+    else fixCluster(index);
   }
 
 
@@ -561,13 +2879,13 @@ private:
     for (std::size_t i = 0; i < _capacity; i++) {
       std::cout<<i<<": ";
       if (not isEmpty(i)) {
-        KeyValue *kv = table[i].kv;
-        std::size_t displacement = entryDist(hashToIndex(table[i].hash), i);
-        std::cout<<kv->key<<" = "<<kv->value<<" ";
+        const KeyValue& kv = kvAt(i);
+        std::size_t displacement = entryDist(hashToIndex(hashAt(i)), i);
+        std::cout<<kv.key<<" = "<<kv.value<<" ";
         if (displacement == 0) std::cout<<"(*)";
         else std::cout<<"(+"<<displacement<<")";
 
-        std::cout<<" ["<<table[i].expireTime;
+        std::cout<<" ["<<expireTimeAt(i);
         if (isExpired(i)) std::cout<<"!";
         std::cout<<"]";
       }
@@ -575,13 +2893,13 @@ private:
     }
   }
 
-  void printLRUOrder() const {
+  void printLRUOrder(node_t node) const {
     std::cout<<"[";
-    KeyValue *kv = LRU_oldest;
-    while (kv) {
-      std::cout<<kv->key<<" = "<<kv->value;
-      if (kv->next) std::cout<<", ";
-      kv = kv->next;
+    while (node != NIL) {
+      const KeyValue& kv = kvOf(node);
+      std::cout<<kv.key<<" = "<<kv.value;
+      if (kv.next != NIL) std::cout<<", ";
+      node = kv.next;
     }
     std::cout<<"]"<<std::endl;
   }
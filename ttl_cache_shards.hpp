@@ -0,0 +1,92 @@
+#ifndef TTL_CACHE_SHARDS_H
+#define TTL_CACHE_SHARDS_H
+
+#include <mutex>
+#include <memory> //shards are not movable (because of their locks), so they are stored by pointer
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+/* partitioning of the keys of the thread-safe caches (sharded_ttl_cache, concurrent_ttl_cache and
+   shared_ttl_cache) into shards. keys are assigned to shards by the high bits of their hash, after a
+   multiplicative mix, so that weak hash functions such as the identity std::hash<int> still spread the
+   keys, while the tables inside the shards index by the low bits of the hash.
+   maxEntries is split evenly between the shards
+*/
+class ttl_cache_shard_map {
+
+  unsigned int shardBits; //log2 of the number of shards
+
+public:
+
+  //the number of shards must be a power of two
+  explicit ttl_cache_shard_map(const std::size_t shardCount): shardBits{0} {
+    if (shardCount == 0 or (shardCount & (shardCount-1)) != 0)
+      throw std::invalid_argument("Shard count must be a power of two");
+    while ((std::size_t(1) << shardBits) < shardCount) shardBits++;
+  }
+
+  std::size_t shardCount() const { return std::size_t(1) << shardBits; }
+
+  std::size_t maxEntriesPerShard(const std::size_t maxEntries) const {
+    return (maxEntries + shardCount() - 1) / shardCount();
+  }
+
+  //fibonacci hashing: the multiplication mixes all the bits of the hash into the high bits
+  inline std::size_t shardIndex(const std::size_t hash) const {
+    if (shardBits == 0) return 0;
+    return (std::size_t) ((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> (64 - shardBits));
+  }
+
+};
+
+
+/* the shards of sharded_ttl_cache and concurrent_ttl_cache, allocated on the heap. a Shard is constructed
+   from (maxEntriesPerShard, maxLoadFactor, hashFunction), and has a ttl_cache 'cache' protected by a
+   std::mutex 'lock'
+*/
+template<class Shard, class Key, class HashFunction>
+class ttl_cache_shards {
+
+  const HashFunction hashFunction;
+  ttl_cache_shard_map map;
+  std::vector<std::unique_ptr<Shard>> shards;
+
+public:
+
+  ttl_cache_shards(std::size_t maxEntries, double maxLoadFactor, const HashFunction& hashFunction,
+                   std::size_t shardCount):
+    hashFunction{hashFunction},
+    map(shardCount)
+  {
+    std::size_t maxEntriesPerShard = map.maxEntriesPerShard(maxEntries);
+    shards.reserve(shardCount);
+    for (std::size_t i = 0; i < shardCount; i++) {
+      shards.emplace_back(new Shard(maxEntriesPerShard, maxLoadFactor, this->hashFunction));
+    }
+  }
+
+  inline Shard& shardFor(const Key& key) const {
+    return *shards[map.shardIndex(hashFunction(key))];
+  }
+  inline Shard& operator[](const std::size_t index) const { return *shards[index]; }
+  std::size_t count() const { return shards.size(); }
+
+  //aggregated over all the shards. with concurrent writers, the result is only a snapshot
+  std::size_t size() const {
+    std::size_t res = 0;
+    for (auto& shard : shards) {
+      std::lock_guard<std::mutex> guard(shard->lock);
+      res += shard->cache.size();
+    }
+    return res;
+  }
+  std::size_t capacity() const {
+    std::size_t res = 0;
+    for (auto& shard : shards) res += shard->cache.capacity(); //constant, no need to lock
+    return res;
+  }
+
+};
+
+#endif /* TTL_CACHE_SHARDS_H */
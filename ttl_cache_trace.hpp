@@ -0,0 +1,324 @@
+#ifndef TTL_CACHE_TRACE_H
+#define TTL_CACHE_TRACE_H
+
+#include "ttl_cache.hpp" //ttl_cache_serializer
+#include <string>
+#include <vector>
+#include <fstream> //traces are written and read as streams, since they can be much larger than the cache
+#include <optional>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+/* traces of cache operations, to replay real traffic against other cache configurations.
+
+   ttl_cache_recorder wraps a ttl_cache (or a realtime_ttl_cache, or any cache with the same interface)
+   and writes every get, insert and removeExpired call to a trace file, with its time stamp, and for gets,
+   whether the recorded cache had the key. ttl_cache_read_trace reads a trace back, and ttl_cache_replay
+   runs it against another cache, counting its hits, the gets whose outcome differs from the recorded one,
+   and the time taken by the cache operations. dummy_cache, which never evicts, can replay the same trace
+   as an oracle: a hit of any cache must also be a hit of the oracle, with the same value.
+
+   the ttl_cache results are only reproducible if both caches have the same options, the same size,
+   and the same seed (see seedRandom), since the RNG drives the sampling of removeExpired.
+
+   the format is binary and not portable across architectures: a header (magic, version, size of the
+   time stamps), and then one record per operation: the operation (1 byte), its time stamp, and
+   - for get: whether it was a hit (1 byte), the size of the key (32 bits), and its bytes
+   - for insert: the ttl, the sizes of the key and the value (32 bits each), and their bytes
+   - for removeExpired: the target ratio (a double)
+   keys and values are written with the serializers of the snapshots (see ttl_cache_serializer)
+*/
+
+enum class ttl_cache_trace_op : uint8_t { get = 0, insert = 1, removeExpired = 2 };
+
+//one operation of a trace. the fields that do not apply to the operation are left at their defaults
+template<class Key, class Value, class timestamp_t = long long>
+struct ttl_cache_trace_record {
+  ttl_cache_trace_op op = ttl_cache_trace_op::get;
+  timestamp_t timeStamp = 0;
+  Key key{};
+  Value value{}; //insert
+  timestamp_t ttl = 0; //insert
+  bool hit = false; //get: whether the recorded cache returned a value
+  double targetRatio = 0; //removeExpired
+};
+
+struct ttl_cache_trace_header {
+  static constexpr char MAGIC[8] = {'T', 'T', 'L', 'T', 'R', 'A', 'C', 'E'};
+  static constexpr uint32_t VERSION = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t timestampSize;
+};
+
+
+/* writes a trace file. the records are buffered by the stream, and the file is complete once the
+   writer is destroyed (or flushed)
+*/
+template<class Key, class Value, class timestamp_t = long long,
+         class KeySerializer = ttl_cache_serializer<Key>, class ValueSerializer = ttl_cache_serializer<Value>>
+class ttl_cache_trace_writer {
+
+  std::ofstream file;
+  KeySerializer keySerializer;
+  ValueSerializer valueSerializer;
+  std::vector<char> record;
+
+public:
+
+  explicit ttl_cache_trace_writer(const std::string& path, const KeySerializer& keySerializer = KeySerializer(),
+                                  const ValueSerializer& valueSerializer = ValueSerializer()):
+    file(path, std::ios::binary | std::ios::trunc),
+    keySerializer{keySerializer},
+    valueSerializer{valueSerializer}
+  {
+    if (not file) throw std::runtime_error("cannot create trace file " + path);
+    ttl_cache_trace_header header;
+    std::memcpy(header.magic, ttl_cache_trace_header::MAGIC, sizeof(header.magic));
+    header.version = ttl_cache_trace_header::VERSION;
+    header.timestampSize = sizeof(timestamp_t);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  void get(const Key& key, const timestamp_t timeStamp, const bool hit) {
+    std::size_t keySize = checkedSize(keySerializer.size(key));
+    start(ttl_cache_trace_op::get, timeStamp, 1 + sizeof(uint32_t) + keySize);
+    append((uint8_t) hit);
+    append((uint32_t) keySize);
+    keySerializer.write(key, next(keySize));
+    finish();
+  }
+
+  void insert(const Key& key, const Value& value, const timestamp_t timeStamp, const timestamp_t ttl) {
+    std::size_t keySize = checkedSize(keySerializer.size(key)), valueSize = checkedSize(valueSerializer.size(value));
+    start(ttl_cache_trace_op::insert, timeStamp, sizeof(timestamp_t) + 2 * sizeof(uint32_t) + keySize + valueSize);
+    append(ttl);
+    append((uint32_t) keySize);
+    append((uint32_t) valueSize);
+    keySerializer.write(key, next(keySize));
+    valueSerializer.write(value, next(valueSize));
+    finish();
+  }
+
+  void removeExpired(const timestamp_t timeStamp, const double targetRatio) {
+    start(ttl_cache_trace_op::removeExpired, timeStamp, sizeof(double));
+    append(targetRatio);
+    finish();
+  }
+
+  void flush() {
+    if (not file.flush()) throw std::runtime_error("cannot write trace file");
+  }
+
+private:
+
+  static std::size_t checkedSize(const std::size_t size) {
+    if (size > UINT32_MAX) throw std::length_error("key or value too large for a trace");
+    return size;
+  }
+
+  //the record is assembled in 'record', which keeps its capacity between records
+  void start(const ttl_cache_trace_op op, const timestamp_t timeStamp, const std::size_t bodySize) {
+    record.clear();
+    record.reserve(1 + sizeof(timestamp_t) + bodySize);
+    append((uint8_t) op);
+    append(timeStamp);
+  }
+
+  template<class T>
+  void append(const T& field) {
+    std::memcpy(next(sizeof(T)), &field, sizeof(T));
+  }
+
+  char* next(const std::size_t size) {
+    record.resize(record.size() + size);
+    return record.data() + record.size() - size;
+  }
+
+  void finish() {
+    file.write(record.data(), record.size());
+  }
+
+};
+
+
+//reads a whole trace file into memory, so that replaying it does not measure the file reads
+template<class Key, class Value, class timestamp_t = long long,
+         class KeySerializer = ttl_cache_serializer<Key>, class ValueSerializer = ttl_cache_serializer<Value>>
+std::vector<ttl_cache_trace_record<Key, Value, timestamp_t>> ttl_cache_read_trace(
+    const std::string& path, const KeySerializer& keySerializer = KeySerializer(),
+    const ValueSerializer& valueSerializer = ValueSerializer()) {
+
+  std::ifstream file(path, std::ios::binary);
+  if (not file) throw std::runtime_error("cannot open trace file " + path);
+  ttl_cache_trace_header header;
+  if (not file.read(reinterpret_cast<char*>(&header), sizeof(header)) or
+      std::memcmp(header.magic, ttl_cache_trace_header::MAGIC, sizeof(header.magic)) != 0 or
+      header.version != ttl_cache_trace_header::VERSION or header.timestampSize != sizeof(timestamp_t)) {
+    throw std::runtime_error("invalid trace file " + path);
+  }
+
+  auto readField = [&file, &path](auto& field) {
+    if (not file.read(reinterpret_cast<char*>(&field), sizeof(field))) throw std::runtime_error("truncated trace file " + path);
+  };
+  std::vector<char> bytes;
+  auto readBytes = [&file, &path, &bytes](const uint32_t size) {
+    bytes.resize(size);
+    if (not file.read(bytes.data(), size)) throw std::runtime_error("truncated trace file " + path);
+    return bytes.data();
+  };
+
+  std::vector<ttl_cache_trace_record<Key, Value, timestamp_t>> records;
+  uint8_t op;
+  while (file.read(reinterpret_cast<char*>(&op), 1)) {
+    ttl_cache_trace_record<Key, Value, timestamp_t> record;
+    record.op = (ttl_cache_trace_op) op;
+    readField(record.timeStamp);
+    uint32_t sizes[2];
+    switch (record.op) {
+      case ttl_cache_trace_op::get: {
+        uint8_t hit;
+        readField(hit);
+        record.hit = hit != 0;
+        readField(sizes[0]);
+        record.key = keySerializer.read(readBytes(sizes[0]), sizes[0]);
+        break;
+      }
+      case ttl_cache_trace_op::insert:
+        readField(record.ttl);
+        readField(sizes);
+        record.key = keySerializer.read(readBytes(sizes[0]), sizes[0]);
+        record.value = valueSerializer.read(readBytes(sizes[1]), sizes[1]);
+        break;
+      case ttl_cache_trace_op::removeExpired:
+        readField(record.targetRatio);
+        break;
+      default:
+        throw std::runtime_error("invalid trace file " + path);
+    }
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+
+/* wraps a cache and records its operations into a trace file, forwarding the calls unchanged.
+   with a realtime_ttl_cache (the calls without time stamps), the time stamp of each record is read from
+   the clock of the cache just before the call, so it can be slightly earlier than the one the cache uses
+*/
+template<class Key, class Value, class Cache, class timestamp_t = long long,
+         class KeySerializer = ttl_cache_serializer<Key>, class ValueSerializer = ttl_cache_serializer<Value>>
+class ttl_cache_recorder {
+
+  Cache& cache;
+  ttl_cache_trace_writer<Key, Value, timestamp_t, KeySerializer, ValueSerializer> writer;
+
+public:
+
+  ttl_cache_recorder(Cache& cache, const std::string& path, const KeySerializer& keySerializer = KeySerializer(),
+                     const ValueSerializer& valueSerializer = ValueSerializer()):
+    cache(cache),
+    writer(path, keySerializer, valueSerializer) {}
+
+  //logical time: ttl_cache and the thread-safe caches
+
+  std::optional<Value> get(const Key& key, timestamp_t timeStamp) {
+    std::optional<Value> res = cache.get(key, timeStamp);
+    writer.get(key, timeStamp, res.has_value());
+    return res;
+  }
+
+  void insert(const Key& key, const Value& value, timestamp_t timeStamp, timestamp_t ttl) {
+    cache.insert(key, value, timeStamp, ttl);
+    writer.insert(key, value, timeStamp, ttl);
+  }
+
+  double removeExpired(timestamp_t timeStamp, double targetRatio) {
+    double res = cache.removeExpired(timeStamp, targetRatio);
+    writer.removeExpired(timeStamp, targetRatio);
+    return res;
+  }
+
+  //real time: realtime_ttl_cache
+
+  std::optional<Value> get(const Key& key) {
+    timestamp_t timeStamp = cache.currentTimeStamp();
+    std::optional<Value> res = cache.get(key);
+    writer.get(key, timeStamp, res.has_value());
+    return res;
+  }
+
+  void insert(const Key& key, const Value& value, timestamp_t ticsToLive) {
+    timestamp_t timeStamp = cache.currentTimeStamp();
+    cache.insert(key, value, ticsToLive);
+    writer.insert(key, value, timeStamp, ticsToLive);
+  }
+
+  double removeExpired(double targetRatio) {
+    timestamp_t timeStamp = cache.currentTimeStamp();
+    double res = cache.removeExpired(targetRatio);
+    writer.removeExpired(timeStamp, targetRatio);
+    return res;
+  }
+
+  void flush() { writer.flush(); }
+
+};
+
+
+struct ttl_cache_replay_result {
+  std::size_t operations = 0;
+  std::size_t gets = 0;
+  std::size_t hits = 0;
+  std::size_t divergences = 0; //gets whose outcome (hit or miss) differs from the recorded one
+  double seconds = 0; //of the cache operations (and of 'onGet')
+
+  double hitRatio() const { return gets == 0 ? 0 : hits/(double) gets; }
+  double nanosPerOperation() const { return operations == 0 ? 0 : 1e9 * seconds / operations; }
+};
+
+/* runs the records of a trace, in order, against 'cache', which needs the interface of ttl_cache:
+   get(key, timeStamp), insert(key, value, timeStamp, ttl), and removeExpired(timeStamp, targetRatio).
+   'onGet' is called with the index of each get record and its result, e.g., to compare it with an oracle
+*/
+template<class Key, class Value, class timestamp_t, class Cache, class OnGet>
+ttl_cache_replay_result ttl_cache_replay(const std::vector<ttl_cache_trace_record<Key, Value, timestamp_t>>& records,
+                                         Cache& cache, OnGet&& onGet) {
+  ttl_cache_replay_result res;
+  auto startTime = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < records.size(); i++) {
+    const ttl_cache_trace_record<Key, Value, timestamp_t>& record = records[i];
+    switch (record.op) {
+      case ttl_cache_trace_op::get: {
+        std::optional<Value> value = cache.get(record.key, record.timeStamp);
+        res.gets++;
+        if (value) res.hits++;
+        if (value.has_value() != record.hit) res.divergences++;
+        onGet(i, value);
+        break;
+      }
+      case ttl_cache_trace_op::insert:
+        cache.insert(record.key, record.value, record.timeStamp, record.ttl);
+        break;
+      case ttl_cache_trace_op::removeExpired:
+        cache.removeExpired(record.timeStamp, record.targetRatio);
+        break;
+    }
+  }
+  auto endTime = std::chrono::steady_clock::now();
+  res.operations = records.size();
+  res.seconds = std::chrono::duration<double>(endTime - startTime).count();
+  return res;
+}
+
+template<class Key, class Value, class timestamp_t, class Cache>
+ttl_cache_replay_result ttl_cache_replay(const std::vector<ttl_cache_trace_record<Key, Value, timestamp_t>>& records,
+                                         Cache& cache) {
+  return ttl_cache_replay(records, cache, [](std::size_t, const std::optional<Value>&) {});
+}
+
+#endif /* TTL_CACHE_TRACE_H */